@@ -0,0 +1,102 @@
+// Requests parsed per second by HttpRequestParser, for a typical DLNA renderer request
+// delivered whole, split into small segments, and pipelined.
+#include "core/http_request_parser.h"
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <cstdio>
+
+using CastIt::HttpRequestParser;
+
+namespace
+{
+	const QByteArray SampleRequest =
+		"GET /media/0123456789abcdef0123456789abcdef/movie.mkv HTTP/1.1\r\n"
+		"Host: 192.168.1.20:49152\r\n"
+		"User-Agent: UPnP/1.0 DLNADOC/1.50 Platinum/1.0.5.13\r\n"
+		"Accept: */*\r\n"
+		"Range: bytes=734003200-\r\n"
+		"getcontentFeatures.dlna.org: 1\r\n"
+		"transferMode.dlna.org: Streaming\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n";
+
+	constexpr int Iterations = 1000000;
+
+	void report(const char* name, qint64 requests, qint64 elapsedNs, quint64 checksum)
+	{
+		const double seconds = double(elapsedNs) / 1e9;
+		std::printf("%-12s %12.0f requests/s  (%lld requests, checksum %llu)\n",
+			name, double(requests) / seconds, requests, static_cast<unsigned long long>(checksum));
+	}
+
+	void benchWhole()
+	{
+		HttpRequestParser parser;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; ++i)
+		{
+			parser.append(SampleRequest);
+			if (parser.parse() == HttpRequestParser::Status::Complete)
+				checksum += parser.request().range.size();
+			parser.consume();
+		}
+		report("whole", Iterations, timer.nsecsElapsed(), checksum);
+	}
+
+	void benchSplit(qsizetype segmentSize)
+	{
+		HttpRequestParser parser;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations / 4; ++i)
+		{
+			for (qsizetype offset = 0; offset < SampleRequest.size(); offset += segmentSize)
+			{
+				parser.append(QByteArrayView(SampleRequest).sliced(offset, qMin(segmentSize, SampleRequest.size() - offset)));
+				if (parser.parse() == HttpRequestParser::Status::Complete)
+				{
+					checksum += parser.request().headerCount;
+					parser.consume();
+				}
+			}
+		}
+		char name[32];
+		std::snprintf(name, sizeof(name), "split/%lld", static_cast<long long>(segmentSize));
+		report(name, Iterations / 4, timer.nsecsElapsed(), checksum);
+	}
+
+	void benchPipelined(int depth)
+	{
+		const QByteArray batch = SampleRequest.repeated(depth);
+		HttpRequestParser parser;
+		quint64 checksum = 0;
+		qint64 parsed = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations / depth; ++i)
+		{
+			parser.append(batch);
+			while (parser.parse() == HttpRequestParser::Status::Complete)
+			{
+				checksum += parser.request().target.size();
+				parser.consume();
+				++parsed;
+			}
+		}
+		char name[32];
+		std::snprintf(name, sizeof(name), "pipelined/%d", depth);
+		report(name, parsed, timer.nsecsElapsed(), checksum);
+	}
+}
+
+int main()
+{
+	benchWhole();
+	benchSplit(16);
+	benchSplit(1);
+	benchPipelined(8);
+	return 0;
+}
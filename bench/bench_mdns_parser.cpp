@@ -0,0 +1,176 @@
+// Packets parsed per second by MdnsMessage for a typical Chromecast announcement (PTR, SRV, TXT
+// and A records with name compression), with and without decoding every name, and for a
+// malformed packet whose compression pointers loop.
+#include "core/mdns_message.h"
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QList>
+#include <cstdio>
+
+using CastIt::DnsName;
+using CastIt::MdnsMessage;
+
+namespace
+{
+	constexpr int Iterations = 2000000;
+
+	void append16(QByteArray& packet, quint16 value)
+	{
+		packet.append(char(value >> 8)).append(char(value & 0xFF));
+	}
+
+	void append32(QByteArray& packet, quint32 value)
+	{
+		append16(packet, quint16(value >> 16));
+		append16(packet, quint16(value & 0xFFFF));
+	}
+
+	void appendLabel(QByteArray& packet, const QByteArray& label)
+	{
+		packet.append(char(label.size())).append(label);
+	}
+
+	void appendPointer(QByteArray& packet, qsizetype offset)
+	{
+		packet.append(char(0xC0 | (offset >> 8))).append(char(offset & 0xFF));
+	}
+
+	void appendRecordHeader(QByteArray& packet, quint16 type, quint32 ttl, quint16 rdataLength)
+	{
+		append16(packet, type);
+		append16(packet, 0x8001); // Cache-flush, IN
+		append32(packet, ttl);
+		append16(packet, rdataLength);
+	}
+
+	QByteArray chromecastResponse()
+	{
+		QByteArray packet;
+		append16(packet, 0);
+		append16(packet, 0x8400);
+		append16(packet, 0);
+		append16(packet, 1);
+		append16(packet, 0);
+		append16(packet, 3);
+
+		const qsizetype service = packet.size();
+		appendLabel(packet, "_googlecast");
+		appendLabel(packet, "_tcp");
+		const qsizetype local = packet.size();
+		appendLabel(packet, "local");
+		packet.append('\0');
+
+		const QByteArray instanceLabel = "Chromecast-Ultra-4f8e2a9c1d7b6e3f";
+		appendRecordHeader(packet, CastIt::Dns::PTR, 120, quint16(1 + instanceLabel.size() + 2));
+		const qsizetype instance = packet.size();
+		appendLabel(packet, instanceLabel);
+		appendPointer(packet, service);
+
+		const QByteArray hostLabel = "4f8e2a9c-1d7b-6e3f-0000-000000000000";
+		appendPointer(packet, instance);
+		appendRecordHeader(packet, CastIt::Dns::SRV, 120, quint16(6 + 1 + hostLabel.size() + 2));
+		append16(packet, 0);
+		append16(packet, 0);
+		append16(packet, 8009);
+		const qsizetype host = packet.size();
+		appendLabel(packet, hostLabel);
+		appendPointer(packet, local);
+
+		const QList<QByteArray> txt = { "id=4f8e2a9c1d7b6e3f", "cd=0123456789ABCDEF", "rm=", "ve=05",
+			"md=Chromecast Ultra", "ic=/setup/icon.png", "fn=Living Room TV", "ca=201221", "st=0", "bs=FA8FCA", "nf=1", "rs=" };
+		qsizetype txtLength = 0;
+		for (const QByteArray& entry : txt)
+			txtLength += 1 + entry.size();
+		appendPointer(packet, instance);
+		appendRecordHeader(packet, CastIt::Dns::TXT, 4500, quint16(txtLength));
+		for (const QByteArray& entry : txt)
+			appendLabel(packet, entry);
+
+		appendPointer(packet, host);
+		appendRecordHeader(packet, CastIt::Dns::A, 120, 4);
+		append32(packet, 0xC0A80114);
+		return packet;
+	}
+
+	// One answer whose name is a label followed by pointers that chase each other
+	QByteArray pointerLoop()
+	{
+		QByteArray packet(12, '\0');
+		packet[7] = 1; // One answer
+		appendLabel(packet, "a");
+		appendPointer(packet, 12);
+		appendRecordHeader(packet, CastIt::Dns::PTR, 120, 0);
+		return packet;
+	}
+
+	void report(const char* name, qint64 packets, qint64 elapsedNs, quint64 checksum)
+	{
+		const double seconds = double(elapsedNs) / 1e9;
+		std::printf("%-14s %12.0f packets/s  (%lld packets, checksum %llu)\n",
+			name, double(packets) / seconds, packets, static_cast<unsigned long long>(checksum));
+	}
+
+	void benchLayout(const QByteArray& packet)
+	{
+		MdnsMessage message;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; ++i)
+		{
+			if (message.parse(packet))
+				checksum += message.recordCount();
+		}
+		report("layout", Iterations, timer.nsecsElapsed(), checksum);
+	}
+
+	void benchDecode(const QByteArray& packet)
+	{
+		MdnsMessage message;
+		DnsName name;
+		MdnsMessage::Srv srv;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; ++i)
+		{
+			if (!message.parse(packet))
+				continue;
+			for (int r = 0; r < message.recordCount(); ++r)
+			{
+				const MdnsMessage::Record& record = message.record(r);
+				if (message.readName(record.nameOffset, name))
+					checksum += name.size;
+				if (message.ptrTarget(record, name))
+					checksum += name.size;
+				if (message.srv(record, srv))
+					checksum += srv.port;
+			}
+		}
+		report("decode", Iterations, timer.nsecsElapsed(), checksum);
+	}
+
+	void benchMalformed(const QByteArray& packet)
+	{
+		MdnsMessage message;
+		DnsName name;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; ++i)
+		{
+			if (message.parse(packet) && message.recordCount() > 0 && !message.readName(message.record(0).nameOffset, name))
+				++checksum;
+		}
+		report("pointer-loop", Iterations, timer.nsecsElapsed(), checksum);
+	}
+}
+
+int main()
+{
+	const QByteArray packet = chromecastResponse();
+	benchLayout(packet);
+	benchDecode(packet);
+	benchMalformed(pointerLoop());
+	return 0;
+}
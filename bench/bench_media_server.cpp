@@ -0,0 +1,379 @@
+// Loopback load test of the media server: the real MediaServer runs in-process and client threads
+// fetch sparse synthetic files over keep-alive connections, either as sequential full reads or as
+// random Range seeks. Reports throughput, latency percentiles, peak RSS and, on Linux, read/write
+// syscalls per MB made by the server's threads. --json writes the results for comparing builds.
+#include "core/media_server.h"
+#include "core/chunk_cache.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTcpSocket>
+#include <QFile>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using CastIt::MediaServer;
+
+namespace
+{
+	struct Config
+	{
+		int clients = 8;
+		int fileCount = 4;
+		qint64 fileSize = 256ll * 1024 * 1024;
+		int sequentialReads = 2; // Full reads per client
+		int randomRequests = 200; // Range requests per client
+		qint64 rangeSize = 256 * 1024;
+		qint64 cacheBudget = -1; // -1 keeps the ChunkCache default
+		QStringList scenarios = { "sequential", "random" };
+	};
+
+	struct Sample
+	{
+		qint64 latencyNs = 0; // Request sent to last body byte
+		qint64 ttfbNs = 0; // Request sent to first response byte
+	};
+
+	struct ClientResult
+	{
+		std::vector<Sample> samples;
+		qint64 bodyBytes = 0;
+		int failures = 0;
+	};
+
+	struct ScenarioResult
+	{
+		QString name;
+		qint64 requests = 0;
+		int failures = 0;
+		qint64 bodyBytes = 0;
+		double seconds = 0.0;
+		double latencyP50Ms = 0.0;
+		double latencyP99Ms = 0.0;
+		double ttfbP50Ms = 0.0;
+		double ttfbP99Ms = 0.0;
+		qint64 peakRssKiB = -1;
+		double syscallsPerMB = -1.0;
+	};
+
+	// Sum of syscr + syscw over the server's threads, -1 where /proc isn't available
+	qint64 serverSyscalls()
+	{
+		const QDir tasks("/proc/self/task");
+		if (!tasks.exists())
+			return -1;
+
+		const QString mainTask = QString::number(QCoreApplication::applicationPid());
+		qint64 total = 0;
+		for (const QString& task : tasks.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+		{
+			QFile comm(tasks.filePath(task + "/comm"));
+			if (!comm.open(QIODevice::ReadOnly))
+				continue;
+			// MediaIO-* threads serve requests, the main thread accepts connections
+			if (!comm.readAll().startsWith("MediaIO-") && task != mainTask)
+				continue;
+
+			QFile io(tasks.filePath(task + "/io"));
+			if (!io.open(QIODevice::ReadOnly))
+				continue;
+			for (const QByteArray& line : io.readAll().split('\n'))
+			{
+				if (line.startsWith("syscr:") || line.startsWith("syscw:"))
+					total += line.mid(6).trimmed().toLongLong();
+			}
+		}
+		return total;
+	}
+
+	qint64 peakRssKiB()
+	{
+		QFile status("/proc/self/status");
+		if (!status.open(QIODevice::ReadOnly))
+			return -1;
+		for (const QByteArray& line : status.readAll().split('\n'))
+		{
+			if (line.startsWith("VmHWM:"))
+				return line.mid(6).trimmed().split(' ').first().toLongLong();
+		}
+		return -1;
+	}
+
+	double percentileMs(std::vector<qint64>& values, double q)
+	{
+		if (values.empty())
+			return 0.0;
+		const size_t index = std::min(values.size() - 1, size_t(q * double(values.size())));
+		std::nth_element(values.begin(), values.begin() + index, values.end());
+		return double(values[index]) / 1e6;
+	}
+
+	// One keep-alive request/response exchange. Returns the body length or -1 on failure.
+	qint64 fetch(QTcpSocket& socket, const QByteArray& request, Sample& sample)
+	{
+		static thread_local QByteArray buffer(256 * 1024, Qt::Uninitialized);
+
+		QElapsedTimer timer;
+		timer.start();
+		socket.write(request);
+		if (!socket.waitForBytesWritten(10000))
+			return -1;
+
+		QByteArray head;
+		qsizetype headEnd = -1;
+		while (headEnd < 0)
+		{
+			if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(10000))
+				return -1;
+			if (head.isEmpty())
+				sample.ttfbNs = timer.nsecsElapsed();
+			head += socket.read(qMax<qint64>(1, qMin<qint64>(socket.bytesAvailable(), 4096)));
+			headEnd = head.indexOf("\r\n\r\n");
+		}
+
+		const bool success = head.startsWith("HTTP/1.1 200") || head.startsWith("HTTP/1.1 206");
+		qint64 contentLength = 0;
+		for (const QByteArray& line : head.left(headEnd).split('\n'))
+		{
+			if (line.toLower().startsWith("content-length:"))
+				contentLength = line.mid(15).trimmed().toLongLong();
+		}
+
+		// Whatever followed the head in the last read already belongs to the body
+		qint64 remaining = contentLength - (head.size() - headEnd - 4);
+		while (remaining > 0)
+		{
+			if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(10000))
+				return -1;
+			const qint64 read = socket.read(buffer.data(), qMin<qint64>(remaining, buffer.size()));
+			if (read < 0)
+				return -1;
+			remaining -= read;
+		}
+		sample.latencyNs = timer.nsecsElapsed();
+		return success ? contentLength : -1;
+	}
+
+	void runClient(int clientIndex, const QString& scenario, const Config& config, quint16 port,
+		const QStringList& paths, ClientResult& result)
+	{
+		QTcpSocket socket;
+		socket.connectToHost(QHostAddress::LocalHost, port);
+		if (!socket.waitForConnected(10000))
+		{
+			++result.failures;
+			return;
+		}
+
+		QRandomGenerator random(quint32(clientIndex) * 7919u + 1u);
+		const bool sequential = scenario == "sequential";
+		const int requests = sequential ? config.sequentialReads : config.randomRequests;
+		for (int i = 0; i < requests; ++i)
+		{
+			const QByteArray path = paths[(clientIndex + i) % paths.size()].toLatin1();
+			QByteArray request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+			if (!sequential)
+			{
+				const qint64 first = random.bounded(qMax<qint64>(1, config.fileSize - config.rangeSize));
+				request += "Range: bytes=" + QByteArray::number(first) + '-' +
+					QByteArray::number(first + config.rangeSize - 1) + "\r\n";
+			}
+			request += "\r\n";
+
+			Sample sample;
+			const qint64 bytes = fetch(socket, request, sample);
+			if (bytes < 0)
+			{
+				++result.failures;
+				return; // The connection is in an unknown state, stop this client
+			}
+			result.bodyBytes += bytes;
+			result.samples.push_back(sample);
+		}
+	}
+
+	ScenarioResult runScenario(const QString& scenario, const Config& config, quint16 port, const QStringList& paths)
+	{
+		ScenarioResult result;
+		result.name = scenario;
+
+		std::vector<ClientResult> clientResults(config.clients);
+		const qint64 syscallsBefore = serverSyscalls();
+		QElapsedTimer timer;
+		timer.start();
+
+		std::vector<std::thread> clients;
+		for (int i = 0; i < config.clients; ++i)
+		{
+			clients.emplace_back([&, i]()
+				{
+					runClient(i, scenario, config, port, paths, clientResults[i]);
+				});
+		}
+		for (std::thread& client : clients)
+			client.join();
+
+		result.seconds = double(timer.nsecsElapsed()) / 1e9;
+		const qint64 syscallsAfter = serverSyscalls();
+
+		std::vector<qint64> latencies;
+		std::vector<qint64> ttfbs;
+		for (const ClientResult& client : clientResults)
+		{
+			result.failures += client.failures;
+			result.bodyBytes += client.bodyBytes;
+			for (const Sample& sample : client.samples)
+			{
+				latencies.push_back(sample.latencyNs);
+				ttfbs.push_back(sample.ttfbNs);
+			}
+		}
+		result.requests = qint64(latencies.size());
+		result.latencyP50Ms = percentileMs(latencies, 0.50);
+		result.latencyP99Ms = percentileMs(latencies, 0.99);
+		result.ttfbP50Ms = percentileMs(ttfbs, 0.50);
+		result.ttfbP99Ms = percentileMs(ttfbs, 0.99);
+		result.peakRssKiB = peakRssKiB();
+		if (syscallsBefore >= 0 && result.bodyBytes > 0)
+			result.syscallsPerMB = double(syscallsAfter - syscallsBefore) / (double(result.bodyBytes) / (1024.0 * 1024.0));
+		return result;
+	}
+
+	QJsonObject toJson(const ScenarioResult& result)
+	{
+		return QJsonObject{
+			{ "scenario", result.name },
+			{ "requests", result.requests },
+			{ "failures", result.failures },
+			{ "bodyBytes", result.bodyBytes },
+			{ "seconds", result.seconds },
+			{ "throughputMBps", result.seconds > 0 ? double(result.bodyBytes) / (1024.0 * 1024.0) / result.seconds : 0.0 },
+			{ "latencyP50Ms", result.latencyP50Ms },
+			{ "latencyP99Ms", result.latencyP99Ms },
+			{ "ttfbP50Ms", result.ttfbP50Ms },
+			{ "ttfbP99Ms", result.ttfbP99Ms },
+			{ "peakRssKiB", result.peakRssKiB },
+			{ "syscallsPerMB", result.syscallsPerMB }
+		};
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName("castit_bench_mediaserver");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Loopback load test of the CastIt media server");
+	parser.addHelpOption();
+	const QCommandLineOption clientsOption("clients", "Concurrent keep-alive clients.", "n", "8");
+	const QCommandLineOption filesOption("files", "Synthetic files to publish.", "n", "4");
+	const QCommandLineOption sizeOption("file-size", "Size of each synthetic file in MiB.", "mib", "256");
+	const QCommandLineOption sequentialOption("sequential-reads", "Full reads per client.", "n", "2");
+	const QCommandLineOption randomOption("random-requests", "Range requests per client.", "n", "200");
+	const QCommandLineOption rangeOption("range-size", "Bytes per Range request, in KiB.", "kib", "256");
+	const QCommandLineOption cacheOption("cache", "ChunkCache budget in MiB.", "mib");
+	const QCommandLineOption scenarioOption("scenario", "sequential, random or all.", "name", "all");
+	const QCommandLineOption jsonOption("json", "Write results as JSON to this file, - for stdout.", "path");
+	parser.addOptions({ clientsOption, filesOption, sizeOption, sequentialOption, randomOption, rangeOption,
+		cacheOption, scenarioOption, jsonOption });
+	parser.process(app);
+
+	Config config;
+	config.clients = qMax(1, parser.value(clientsOption).toInt());
+	config.fileCount = qMax(1, parser.value(filesOption).toInt());
+	config.fileSize = qMax<qint64>(1, parser.value(sizeOption).toLongLong()) * 1024 * 1024;
+	config.sequentialReads = qMax(1, parser.value(sequentialOption).toInt());
+	config.randomRequests = qMax(1, parser.value(randomOption).toInt());
+	config.rangeSize = qBound<qint64>(1, parser.value(rangeOption).toLongLong() * 1024, config.fileSize);
+	if (parser.isSet(cacheOption))
+		config.cacheBudget = parser.value(cacheOption).toLongLong() * 1024 * 1024;
+	if (parser.value(scenarioOption) != "all")
+		config.scenarios = { parser.value(scenarioOption) };
+
+	// Sparse files: the page cache serves zeros, so the numbers measure the server rather than the disk
+	QTemporaryDir directory;
+	MediaServer* server = MediaServer::instance();
+	server->setPacing(0.0, 0);
+	if (config.cacheBudget >= 0)
+		CastIt::ChunkCache::instance().setBudget(config.cacheBudget);
+
+	QStringList paths;
+	for (int i = 0; i < config.fileCount; ++i)
+	{
+		QFile file(directory.filePath(QString("synthetic-%1.bin").arg(i)));
+		if (!file.open(QIODevice::WriteOnly) || !file.resize(config.fileSize))
+		{
+			std::fprintf(stderr, "Cannot create %s\n", qPrintable(file.fileName()));
+			return 1;
+		}
+		const QString token = server->publish(file.fileName(), "application/octet-stream");
+		if (token.isEmpty())
+		{
+			std::fprintf(stderr, "Cannot start media server: %s\n", qPrintable(server->errorString()));
+			return 1;
+		}
+		paths.append(QString("/media/%1/synthetic-%2.bin").arg(token).arg(i));
+	}
+
+	// The listener lives on this thread, so the load runs on a driver thread while the event loop spins
+	QList<ScenarioResult> results;
+	const quint16 port = server->port();
+	std::thread driver([&]()
+		{
+			for (const QString& scenario : config.scenarios)
+				results.append(runScenario(scenario, config, port, paths));
+			QMetaObject::invokeMethod(&app, &QCoreApplication::quit, Qt::QueuedConnection);
+		});
+	app.exec();
+	driver.join();
+
+	std::printf("%-11s %8s %6s %10s %10s %10s %10s %10s %10s %12s\n", "scenario", "requests", "fail", "MB/s",
+		"p50 ms", "p99 ms", "ttfb p50", "ttfb p99", "RSS KiB", "syscalls/MB");
+	QJsonArray scenarios;
+	for (const ScenarioResult& result : results)
+	{
+		const QJsonObject json = toJson(result);
+		std::printf("%-11s %8lld %6d %10.1f %10.2f %10.2f %10.2f %10.2f %10lld %12.1f\n", qPrintable(result.name),
+			result.requests, result.failures, json.value("throughputMBps").toDouble(), result.latencyP50Ms,
+			result.latencyP99Ms, result.ttfbP50Ms, result.ttfbP99Ms, result.peakRssKiB, result.syscallsPerMB);
+		scenarios.append(json);
+	}
+
+	if (parser.isSet(jsonOption))
+	{
+		const QJsonObject report{
+			{ "qtVersion", QString::fromLatin1(qVersion()) },
+			{ "workers", server->workerCount() },
+			{ "clients", config.clients },
+			{ "files", config.fileCount },
+			{ "fileSize", config.fileSize },
+			{ "rangeSize", config.rangeSize },
+			{ "cacheBudget", CastIt::ChunkCache::instance().budget() },
+			{ "scenarios", scenarios }
+		};
+		const QByteArray text = QJsonDocument(report).toJson();
+		if (parser.value(jsonOption) == "-")
+		{
+			std::fwrite(text.constData(), 1, text.size(), stdout);
+		}
+		else
+		{
+			QFile output(parser.value(jsonOption));
+			if (!output.open(QIODevice::WriteOnly) || output.write(text) != text.size())
+			{
+				std::fprintf(stderr, "Cannot write %s\n", qPrintable(output.fileName()));
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+// Datagrams parsed per second by SsdpMessage, replaying M-SEARCH responses and NOTIFYs as sent by
+// common renderers, next to the QString/split() scan DlnaDiscovery used before.
+#include "core/ssdp_message.h"
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <cstdio>
+
+using CastIt::SsdpMessage;
+
+namespace
+{
+	constexpr int Iterations = 500000;
+
+	const QList<QByteArray> Captured = {
+		"HTTP/1.1 200 OK\r\n"
+		"CACHE-CONTROL: max-age=1800\r\n"
+		"DATE: Fri, 16 Oct 2026 09:12:44 GMT\r\n"
+		"EXT:\r\n"
+		"LOCATION: http://192.168.1.31:9197/dmr\r\n"
+		"SERVER: SHP, UPnP/1.0, Samsung UPnP SDK/1.0\r\n"
+		"ST: urn:schemas-upnp-org:device:MediaRenderer:1\r\n"
+		"USN: uuid:0a1b2c3d-4e5f-6071-8293-a4b5c6d7e8f9::urn:schemas-upnp-org:device:MediaRenderer:1\r\n"
+		"Content-Length: 0\r\n"
+		"BOOTID.UPNP.ORG: 17\r\n"
+		"CONFIGID.UPNP.ORG: 1\r\n"
+		"\r\n",
+
+		"HTTP/1.1 200 OK\r\n"
+		"Cache-Control: max-age = 120\r\n"
+		"Ext: \r\n"
+		"Location: http://192.168.1.45:1400/xml/device_description.xml\r\n"
+		"Server: Linux UPnP/1.0 Sonos/79.1-56030 (ZPS14)\r\n"
+		"St: urn:schemas-upnp-org:device:MediaRenderer:1\r\n"
+		"Usn: uuid:RINCON_000E58A1B2C301400::urn:schemas-upnp-org:device:MediaRenderer:1\r\n"
+		"X-RINCON-HOUSEHOLD: Sonos_abcdefghijklmnopqrstuvwxyz\r\n"
+		"X-RINCON-BOOTSEQ: 42\r\n"
+		"\r\n",
+
+		// Bare LF line endings, as some embedded stacks send them
+		"HTTP/1.1 200 OK\n"
+		"CACHE-CONTROL: no-cache=\"Ext\", max-age=5000\n"
+		"ST: urn:schemas-upnp-org:device:MediaRenderer:2\n"
+		"USN: uuid:5f9ec1b3-ed59-79bb-4530-745f1e2a8d3c::urn:schemas-upnp-org:device:MediaRenderer:2\n"
+		"EXT:\n"
+		"SERVER: Linux/4.9 UPnP/1.0 GUPnP/1.2.4\n"
+		"LOCATION: http://[fe80::1c2d:3e4f:5a6b:7c8d]:49152/description.xml\n"
+		"\n",
+
+		"NOTIFY * HTTP/1.1\r\n"
+		"HOST: 239.255.255.250:1900\r\n"
+		"CACHE-CONTROL: max-age=1800\r\n"
+		"LOCATION: http://192.168.1.52:49153/description.xml\r\n"
+		"NT: urn:schemas-upnp-org:service:AVTransport:1\r\n"
+		"NTS: ssdp:alive\r\n"
+		"SERVER: Linux/3.10 UPnP/1.0 Kodi/20.2\r\n"
+		"USN: uuid:d3f1a6e0-7c2b-4b9a-9e1f-2a3b4c5d6e7f::urn:schemas-upnp-org:service:AVTransport:1\r\n"
+		"BOOTID.UPNP.ORG: 3\r\n"
+		"\r\n",
+
+		"HTTP/1.1 200 OK\r\n"
+		"CACHE-CONTROL: max-age=100\r\n"
+		"EXT:\r\n"
+		"LOCATION: http://192.168.1.1:1900/igd.xml\r\n"
+		"SERVER: FreeRTOS/6.0.5, UPnP/1.0, IpBridge/1.17.0\r\n"
+		"ST: upnp:rootdevice\r\n"
+		"USN: uuid:2f402f80-da50-11e1-9b23-001788255acc::upnp:rootdevice\r\n"
+		"\r\n" };
+
+	void report(const char* name, qint64 datagrams, qint64 elapsedNs, quint64 checksum)
+	{
+		const double seconds = double(elapsedNs) / 1e9;
+		std::printf("%-12s %12.0f datagrams/s  (%lld datagrams, checksum %llu)\n",
+			name, double(datagrams) / seconds, datagrams, static_cast<unsigned long long>(checksum));
+	}
+
+	void benchParser()
+	{
+		SsdpMessage message;
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; ++i)
+		{
+			for (const QByteArray& datagram : Captured)
+			{
+				if (!message.parse(datagram))
+					continue;
+				if (message.target().startsWith("urn:schemas-upnp-org:device:MediaRenderer:"))
+					checksum += message.location().size();
+				checksum += quint64(message.maxAge()) + message.deviceUuid().size();
+			}
+		}
+		report("ssdp", qint64(Iterations) * Captured.size(), timer.nsecsElapsed(), checksum);
+	}
+
+	// What DlnaDiscovery::processResponse did per datagram before SsdpMessage
+	void benchQString()
+	{
+		quint64 checksum = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations / 10; ++i)
+		{
+			for (const QByteArray& datagram : Captured)
+			{
+				const QString response = QString::fromUtf8(datagram);
+				if (!response.contains("HTTP/1.1 200 OK") ||
+					!(response.contains("ST: urn:schemas-upnp-org:device:MediaRenderer:1") ||
+					  response.contains("NT: urn:schemas-upnp-org:device:MediaRenderer:1")))
+					continue;
+				const QStringList lines = response.split("\r\n");
+				for (const QString& line : lines)
+				{
+					if (line.startsWith("LOCATION:", Qt::CaseInsensitive))
+					{
+						checksum += line.mid(line.indexOf(':') + 1).trimmed().size();
+						break;
+					}
+				}
+			}
+		}
+		report("qstring", qint64(Iterations / 10) * Captured.size(), timer.nsecsElapsed(), checksum);
+	}
+}
+
+int main()
+{
+	benchParser();
+	benchQString();
+	return 0;
+}
@@ -0,0 +1,104 @@
+// Feeds arbitrary datagrams to MdnsMessage::parse and, when a packet is accepted, decodes every
+// name and record the way discovery does and caches them. Built with libFuzzer under MSVC or Clang; with
+// other compilers the same entry point replays the files named on the command line, e.g. crashes
+// found elsewhere or a corpus, so regressions reproduce in any build.
+#include "core/mdns_message.h"
+#include "core/mdns_record_cache.h"
+#include <QByteArrayView>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using CastIt::DnsName;
+using CastIt::MdnsMessage;
+using CastIt::MdnsRecordCache;
+namespace Dns = CastIt::Dns;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	const QByteArrayView packet(reinterpret_cast<const char*>(data), qsizetype(size));
+	MdnsMessage message;
+	if (!message.parse(packet))
+		return 0;
+
+	DnsName name;
+	for (int i = 0; i < message.questionCount(); ++i)
+		message.readName(message.question(i).nameOffset, name);
+	for (int i = 0; i < message.recordCount(); ++i)
+	{
+		const MdnsMessage::Record& record = message.record(i);
+		message.readName(record.nameOffset, name);
+		switch (record.type)
+		{
+		case Dns::PTR:
+			message.ptrTarget(record, name);
+			break;
+		case Dns::SRV:
+		{
+			MdnsMessage::Srv srv;
+			message.srv(record, srv);
+			break;
+		}
+		case Dns::TXT:
+		{
+			qsizetype cursor = 0;
+			QByteArrayView entry;
+			while (message.nextTxtEntry(record, cursor, entry))
+				;
+			break;
+		}
+		case Dns::A:
+		{
+			quint32 address = 0;
+			message.ipv4(record, address);
+			break;
+		}
+		case Dns::AAAA:
+		{
+			std::array<quint8, 16> address;
+			message.ipv6(record, address);
+			break;
+		}
+		default:
+			message.rdata(record);
+			break;
+		}
+	}
+
+	MdnsRecordCache cache;
+	cache.ingest(message, 0);
+	cache.expire(1000);
+	return 0;
+}
+
+#ifndef CASTIT_LIBFUZZER
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::fprintf(stderr, "Usage: %s <packet file>...\n", argv[0]);
+		return 2;
+	}
+	for (int i = 1; i < argc; ++i)
+	{
+		std::FILE* file = std::fopen(argv[i], "rb");
+		if (!file)
+		{
+			std::fprintf(stderr, "Cannot open %s\n", argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[4096];
+		size_t read;
+		while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+			data.insert(data.end(), buffer, buffer + read);
+		std::fclose(file);
+
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+		std::printf("%s: ok (%zu bytes)\n", argv[i], data.size());
+	}
+	return 0;
+}
+#endif
@@ -1,17 +1,16 @@
 #include "cast_controller.h"
+#include "media_server.h"
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QUrl>
-#include <QFileInfo>
 #include <QDebug>
-#include <QTcpServer>
+#include <utility>
 
 namespace CastIt
 {
 	CastController::CastController(QObject* parent) : QObject(parent), networkManager(new QNetworkAccessManager(this)),
-		webSocket(new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this)),
-		mediaServer(new QHttpServer(this))
+		webSocket(new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this))
 	{
 		connect(webSocket, &QWebSocket::connected, this, &CastController::onWebSocketConnected);
 		connect(webSocket, &QWebSocket::disconnected, this, &CastController::onWebSocketDisconnected);
@@ -21,47 +20,32 @@ namespace CastIt
 
 	CastController::~CastController()
 	{
+		for (const QString& token : std::as_const(sessions))
+			MediaServer::instance()->unpublish(token);
 		if (webSocket->isValid())
 		{
 			webSocket->close();
 		}
 	}
 
-	void CastController::startMediaServer(const QString& filePath)
+	void CastController::startMediaServer(const QString& filePath, const QHostAddress& renderer, int interfaceIndex)
 	{
-		QFileInfo fileInfo(filePath);
-		QString fileName = fileInfo.fileName();
-		QString localIp = QHostAddress(QHostAddress::LocalHost).toString();
-		quint16 port = 8000;
+		// Publishes on the process-wide server; a new file for this renderer only retires this
+		// renderer's token, sessions on other devices keep streaming
+		MediaServer* server = MediaServer::instance();
+		retireSession(renderer);
 
-		mediaServer->route("/", [=](const QHttpServerRequest& request)
-			{
-				QFile file(filePath);
-				if (file.open(QIODevice::ReadOnly))
-				{
-					return QHttpServerResponse("video/mp4", file.readAll());
-				}
-				return QHttpServerResponse(QHttpServerResponse::StatusCode::NotFound);
-			});
-
-		QTcpServer* tcpServer = new QTcpServer();
-
-		if (!tcpServer->listen(QHostAddress::Any, port))
+		mediaInfo = MediaProbe::instance().probe(filePath);
+		const QString token = server->publish(filePath, mediaInfo.mimeType);
+		if (token.isEmpty())
 		{
-			qWarning() << "Failed to start TCP server:" << tcpServer->errorString();
-			delete tcpServer;
+			localUrl.clear();
+			emit castingError("Failed to start media server: " + server->errorString());
 			return;
 		}
+		sessions.insert(renderer.toString(), token);
 
-		if (!mediaServer->bind(tcpServer))
-		{
-			qWarning() << "Failed to bind HTTP server to TCP server";
-			delete tcpServer;
-			return;
-		}
-
-		// Construct the local URL
-		QString localUrl = QString("http://%1:%2/%3").arg(localIp).arg(tcpServer->serverPort()).arg(fileName);
+		localUrl = server->urlFor(token, renderer, interfaceIndex);
 		qDebug() << "Media server started at:" << localUrl;
 	}
 
@@ -85,11 +69,14 @@ namespace CastIt
 		{
 			QJsonObject payload;
 			payload["type"] = "LOAD";
-			payload["media"] = QJsonObject{
+			QJsonObject media{
 				{"contentId", mediaUrl},
 				{"streamType", "BUFFERED"},
-				{"contentType", "video/mp4"}
+				{"contentType", QString::fromLatin1(mediaInfo.mimeType.isEmpty() ? QByteArray("video/mp4") : mediaInfo.mimeType)}
 			};
+			if (mediaInfo.durationMs > 0)
+				media["duration"] = mediaInfo.durationMs / 1000.0; // Seconds
+			payload["media"] = media;
 			payload["requestId"] = 1; // Unique request ID
 
 			QJsonObject message;
@@ -108,9 +95,17 @@ namespace CastIt
 	{
 		// Send pause via WebSocket
 	}
-	void CastController::stop()
+	void CastController::stop(const QHostAddress& renderer)
 	{
 		// Send stop via WebSocket
+		retireSession(renderer);
+	}
+
+	void CastController::retireSession(const QHostAddress& renderer)
+	{
+		const QString token = sessions.take(renderer.toString());
+		if (!token.isEmpty())
+			MediaServer::instance()->unpublish(token);
 	}
 
 	// WebSocket callbacks
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <QHash>
 #include <QHostAddress>
 #include <QObject>
 #include <QNetworkAccessManager>
 #include <QWebSocket>
-#include <QHttpServer>
+#include "chunk_cache.h"
+#include "media_probe.h"
 
 
 namespace CastIt
@@ -18,13 +20,15 @@ namespace CastIt
 		explicit CastController(QObject* parent = nullptr);
 		~CastController();
 
-		void startMediaServer(const QString& filePath); // Starts local HTTP server to serve media files
+		// Publishes the file on the shared media server, under an address the renderer can reach
+		void startMediaServer(const QString& filePath, const QHostAddress& renderer = QHostAddress(), int interfaceIndex = 0);
 		void castMedia(const QHostAddress& deviceIp, const QString& mediaUrl); // Sends cast command
 		void play();
 		void pause();
-		void stop();
+		void stop(const QHostAddress& renderer); // Also retires that renderer's session
 
 		QString getLocalUrl() const { return localUrl; }
+		ChunkCache::Stats cacheStats() const { return ChunkCache::instance().stats(); } // Shared media chunk cache
 
 	signals:
 		void castingStatus(const QString& status);
@@ -39,12 +43,14 @@ namespace CastIt
 	private:
 		QNetworkAccessManager* networkManager;
 		QWebSocket* webSocket;
-		QHttpServer* mediaServer;
 		QString localUrl;
+		QHash<QString, QString> sessions; // Token published on the shared MediaServer, by renderer address
+		MediaInfo mediaInfo; // Probed from the published file, announced in LOAD
 		QString sessionId;
 		QString transportId;
 
 		void launchReceiver(const QHostAddress& deviceIp); // Launches receiver app on the cast device
 		void loadMedia(const QString& mediaUrl); // Loads media on the cast device
+		void retireSession(const QHostAddress& renderer);
 	};
 } // namespace CastIt
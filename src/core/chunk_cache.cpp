@@ -0,0 +1,144 @@
+#include "chunk_cache.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+
+namespace CastIt
+{
+	ChunkCache& ChunkCache::instance()
+	{
+		static ChunkCache cache;
+		return cache;
+	}
+
+	quint64 ChunkCache::fileId(const QString& filePath)
+	{
+		const QFileInfo info(filePath);
+		return qHashMulti(0, info.absoluteFilePath(), info.size(), info.lastModified().toMSecsSinceEpoch());
+	}
+
+	void ChunkCache::setBudget(qint64 bytes)
+	{
+		QMutexLocker locker(&mutex);
+		maxBytes = qMax<qint64>(0, bytes);
+		while (counters.bytesCached > maxBytes)
+			evictOneLocked();
+	}
+
+	qint64 ChunkCache::budget() const
+	{
+		QMutexLocker locker(&mutex);
+		return maxBytes;
+	}
+
+	QByteArray ChunkCache::chunk(quint64 fileId, QFile& file, qint64 chunkIndex)
+	{
+		const Key key{ fileId, chunkIndex };
+		{
+			QMutexLocker locker(&mutex);
+			const auto it = index.constFind(key);
+			if (it != index.constEnd())
+			{
+				Entry& entry = entries[it.value()];
+				entry.referenced = true;
+				++counters.hits;
+				return entry.data; // Implicitly shared, eviction can't pull it from under the caller
+			}
+			++counters.misses;
+		}
+
+		// Disk (or NAS) I/O happens outside the lock so other connections keep hitting the cache
+		QByteArray data;
+		if (file.seek(chunkIndex * ChunkSize))
+			data = file.read(ChunkSize);
+		if (data.isEmpty())
+			return data;
+
+		QMutexLocker locker(&mutex);
+		if (!index.contains(key))
+			insertLocked(key, data);
+		return data;
+	}
+
+	void ChunkCache::insert(quint64 fileId, qint64 chunkIndex, const QByteArray& data)
+	{
+		if (data.isEmpty())
+			return;
+
+		const Key key{ fileId, chunkIndex };
+		QMutexLocker locker(&mutex);
+		if (!index.contains(key))
+			insertLocked(key, data);
+	}
+
+	ChunkCache::Stats ChunkCache::stats() const
+	{
+		QMutexLocker locker(&mutex);
+		Stats snapshot = counters;
+		snapshot.budget = maxBytes;
+		return snapshot;
+	}
+
+	void ChunkCache::clear()
+	{
+		QMutexLocker locker(&mutex);
+		entries.clear();
+		freeSlots.clear();
+		index.clear();
+		hand = 0;
+		counters.bytesCached = 0;
+	}
+
+	void ChunkCache::insertLocked(const Key& key, const QByteArray& data)
+	{
+		if (data.size() > maxBytes)
+			return;
+		while (counters.bytesCached + data.size() > maxBytes)
+			evictOneLocked();
+
+		qsizetype slot;
+		if (!freeSlots.isEmpty())
+		{
+			slot = freeSlots.takeLast();
+		}
+		else
+		{
+			slot = entries.size();
+			entries.append(Entry());
+		}
+
+		Entry& entry = entries[slot];
+		entry.key = key;
+		entry.data = data;
+		entry.referenced = false; // A single read earns no second chance; a re-read does
+		entry.used = true;
+		index.insert(key, slot);
+		counters.bytesCached += data.size();
+	}
+
+	void ChunkCache::evictOneLocked()
+	{
+		// Sweep the clock hand, clearing reference bits until an unreferenced chunk turns up
+		while (counters.bytesCached > 0)
+		{
+			const qsizetype slot = hand;
+			Entry& entry = entries[slot];
+			hand = (hand + 1) % entries.size();
+			if (!entry.used)
+				continue;
+			if (entry.referenced)
+			{
+				entry.referenced = false;
+				continue;
+			}
+
+			index.remove(entry.key);
+			counters.bytesCached -= entry.data.size();
+			++counters.evictions;
+			entry.data = QByteArray();
+			entry.used = false;
+			freeSlots.append(slot);
+			return;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QFile>
+
+namespace CastIt
+{
+	// Process-wide cache of fixed-size file chunks shared by every media connection, so the
+	// moov atom, the file tail and anything several renderers play together is read from disk once.
+	// Eviction is CLOCK (second chance), an LRU approximation that needs no list splicing on hits.
+	class ChunkCache
+	{
+	public:
+		static constexpr qint64 ChunkSize = 256 * 1024;
+
+		struct Stats
+		{
+			quint64 hits = 0;
+			quint64 misses = 0;
+			quint64 evictions = 0;
+			qint64 bytesCached = 0;
+			qint64 budget = 0;
+
+			double hitRate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+		};
+
+		static ChunkCache& instance();
+		static quint64 fileId(const QString& filePath); // Changes when the file is replaced or modified
+
+		void setBudget(qint64 bytes); // Evicts immediately if the cache is over the new budget
+		qint64 budget() const;
+
+		// Chunk chunkIndex of file, read from disk on a miss. file must be open; empty on read errors.
+		QByteArray chunk(quint64 fileId, QFile& file, qint64 chunkIndex);
+		// Adds a chunk read elsewhere, e.g. by a fan-out pipeline, unless it is already cached
+		void insert(quint64 fileId, qint64 chunkIndex, const QByteArray& data);
+
+		Stats stats() const;
+		void clear();
+
+	private:
+		struct Key
+		{
+			quint64 fileId;
+			qint64 chunkIndex;
+
+			bool operator==(const Key& other) const { return fileId == other.fileId && chunkIndex == other.chunkIndex; }
+		};
+		friend size_t qHash(const Key& key, size_t seed) { return qHashMulti(seed, key.fileId, key.chunkIndex); }
+
+		struct Entry
+		{
+			Key key{};
+			QByteArray data;
+			bool referenced = false;
+			bool used = false;
+		};
+
+		ChunkCache() = default;
+
+		mutable QMutex mutex;
+		QList<Entry> entries;
+		QList<qsizetype> freeSlots;
+		QHash<Key, qsizetype> index;
+		qsizetype hand = 0;
+		qint64 maxBytes = 64 * 1024 * 1024;
+		Stats counters;
+
+		void insertLocked(const Key& key, const QByteArray& data);
+		void evictOneLocked();
+	};
+}
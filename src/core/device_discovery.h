@@ -1,16 +1,14 @@
 #pragma once
 
 #include <QObject>
-#include <QStringList>
-#include <QUdpSocket>
-#include <QTimer>
-#include <QDataStream>
-#include <QHostAddress>
+#include <QPointer>
 #include <QThread>
-#include <QMap>
 
 namespace CastIt
 {
+    class DeviceDiscoveryWorker;
+
+    // Runs mDNS discovery on a thread of its own; found devices show up in the DeviceRegistry
     class DeviceDiscovery : public QObject
     {
         Q_OBJECT
@@ -19,37 +17,13 @@ namespace CastIt
         ~DeviceDiscovery();
 
         void startDiscovery();
-        void stopDiscovery();
+        void stopDiscovery(); // Blocks until the worker has closed its sockets and published what it had
 
     signals:
-        void devicesUpdated(const QStringList& devices);
-        void discoveryError(const QString& error);
-        void deviceIpsUpdated(const QMap<QString, QHostAddress>& deviceIps);
-
-    private slots:
-        void onDiscoveryThreadStarted();
-        void sendQuery();
-        void processResponse();
-
-		// Make them slots so QTimer::singleShot can invoke them
-        void sendServiceQueriesWithDelay(const QStringList& list, int index);
-        void sendInstanceQueriesWithDelay(int index);
+        void discoveryError(const QString& error); // Delivered on the thread DeviceDiscovery lives on
 
     private:
-        QUdpSocket* udpSocket;
-        QTimer* queryTimer;
         QThread* discoveryThread;
-        QStringList discoveredDevices;
-        QMap<QString, QHostAddress> deviceIps;
-
-        void sendMdnsQuery(const QString& serviceType, quint16 qtype = 12); // Default PTR
-        void parseDnsResponse(const QByteArray& data, const QHostAddress& sender);
-
-
-        void joinMulticastGroups();
-        void printNetworkInterfaces();
-        QHostAddress getLocalAddress() const;
-        bool isCastingService(const QString& name, const QString& serviceName) const;
-        QString extractDeviceName(const QString& serviceName) const;
+        QPointer<DeviceDiscoveryWorker> worker; // Owned by discoveryThread while it runs
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,531 @@
+#include "device_discovery_worker.h"
+#include "mdns_message.h"
+#include "network_interface_monitor.h"
+#include <QtEndian>
+#include <QTimer>
+#include <QNetworkInterface>
+#include <QVariant>
+#include <QNetworkDatagram>
+#include <QHostAddress>
+#include <QDebug>
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace CastIt
+{
+	const QHostAddress DeviceDiscoveryWorker::MdnsGroupIpv4("224.0.0.251");
+	const QHostAddress DeviceDiscoveryWorker::MdnsGroupIpv6("ff02::fb");
+
+	namespace
+	{
+		// Bits of the Cast TXT "ca" field
+		QStringList castCapabilities(uint flags)
+		{
+			static const std::pair<uint, const char*> names[] = {
+				{ 0x01, "video_out" }, { 0x02, "video_in" }, { 0x04, "audio_out" },
+				{ 0x08, "audio_in" }, { 0x20, "multizone_group" } };
+			QStringList capabilities;
+			for (const auto& [bit, name] : names) {
+				if (flags & bit)
+					capabilities.append(name);
+			}
+			return capabilities;
+		}
+	}
+
+	DeviceDiscoveryWorker::DeviceDiscoveryWorker(QObject* parent)
+		: QObject(parent),
+		queryScheduler(new MdnsQueryScheduler(this)),
+		cacheTimer(new QTimer(this)),
+		flushTimer(new QTimer(this))
+	{
+		// Children follow the worker to its thread; none of them is started before it got there
+		cacheClock.start();
+		cacheTimer->setSingleShot(true);
+		connect(cacheTimer, &QTimer::timeout, this, &DeviceDiscoveryWorker::maintainCache);
+		flushTimer->setSingleShot(true);
+		flushTimer->setInterval(FlushDelayMs);
+		connect(flushTimer, &QTimer::timeout, this, &DeviceDiscoveryWorker::flushDevices);
+		connect(queryScheduler, &MdnsQueryScheduler::queriesDue, this, &DeviceDiscoveryWorker::sendQueries);
+	}
+
+	void DeviceDiscoveryWorker::start()
+	{
+		if (running)
+			return;
+		running = true;
+		printNetworkInterfaces();
+
+		// Reopen the sockets and start the query burst over whenever an address comes or goes.
+		// The monitor lives on the GUI thread, so this is a queued connection.
+		connect(NetworkInterfaceMonitor::instance(), &NetworkInterfaceMonitor::interfacesChanged,
+			this, &DeviceDiscoveryWorker::onInterfacesChanged, Qt::UniqueConnection);
+
+		if (!openEndpoints())
+			return;
+
+		// Burst at startup, then back off towards the idle interval; announcements and goodbyes
+		// keep the list current in between
+		queryScheduler->addContinuous("_googlecast._tcp.local.", Dns::PTR);
+		queryScheduler->addContinuous("_airplay._tcp.local.", Dns::PTR);
+		probeStoredDevices();
+
+		qDebug() << "DeviceDiscovery initialized successfully";
+	}
+
+	void DeviceDiscoveryWorker::stop()
+	{
+		if (!running)
+			return;
+		running = false;
+		disconnect(NetworkInterfaceMonitor::instance(), &NetworkInterfaceMonitor::interfacesChanged,
+			this, &DeviceDiscoveryWorker::onInterfacesChanged);
+		cacheTimer->stop();
+		queryScheduler->clear();
+		queryCoalescer.clear();
+		closeEndpoints();
+		flushDevices();
+	}
+
+	void DeviceDiscoveryWorker::onInterfacesChanged()
+	{
+		if (!running)
+			return;
+
+		qDebug() << "Network changed, reopening mDNS sockets and querying again";
+		if (!openEndpoints())
+			return;
+		queryScheduler->addContinuous("_googlecast._tcp.local.", Dns::PTR);
+		queryScheduler->addContinuous("_airplay._tcp.local.", Dns::PTR);
+		queryScheduler->reset(); // Devices on a new network have never heard our questions
+		queryCoalescer.clear();
+	}
+
+	bool DeviceDiscoveryWorker::openEndpoints()
+	{
+		// One socket per interface and address family, so queries leave through every NIC and
+		// every reply is known to have arrived on a particular one
+		closeEndpoints();
+		QString lastError;
+		const QList<QNetworkInterface> ifs = NetworkInterfaceMonitor::instance()->interfaces();
+		for (const QNetworkInterface& iface : ifs) {
+			const auto flags = iface.flags();
+			if (!(flags & QNetworkInterface::IsUp) || !(flags & QNetworkInterface::IsRunning) ||
+				!(flags & QNetworkInterface::CanMulticast) || (flags & QNetworkInterface::IsLoopBack))
+				continue;
+
+			bool hasIpv4 = false;
+			bool hasIpv6 = false;
+			for (const QNetworkAddressEntry& entry : iface.addressEntries()) {
+				hasIpv4 |= entry.ip().protocol() == QAbstractSocket::IPv4Protocol;
+				hasIpv6 |= entry.ip().protocol() == QAbstractSocket::IPv6Protocol;
+			}
+			if (hasIpv4 && !openEndpoint(iface, false, lastError))
+				qDebug() << "mDNS over IPv4 unavailable on" << iface.humanReadableName() << ":" << lastError;
+			if (hasIpv6 && !openEndpoint(iface, true, lastError))
+				qDebug() << "mDNS over IPv6 unavailable on" << iface.humanReadableName() << ":" << lastError;
+		}
+
+		if (endpoints.isEmpty()) {
+			QString errorMessage = "Failed to bind UDP socket for mDNS: " +
+				(lastError.isEmpty() ? QString("no multicast-capable interface") : lastError);
+			qDebug() << errorMessage;
+			emit discoveryError(errorMessage);
+			return false;
+		}
+		return true;
+	}
+
+	bool DeviceDiscoveryWorker::openEndpoint(const QNetworkInterface& iface, bool ipv6, QString& error)
+	{
+		QUdpSocket* socket = new QUdpSocket(this);
+		const QHostAddress group = ipv6 ? MdnsGroupIpv6 : MdnsGroupIpv4;
+		if (!socket->bind(ipv6 ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4, 5353,
+			QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint) ||
+			!socket->joinMulticastGroup(group, iface))
+		{
+			error = socket->errorString();
+			delete socket;
+			return false;
+		}
+
+		socket->setSocketOption(QAbstractSocket::MulticastTtlOption,
+			QVariant::fromValue<quint32>(255));
+		socket->setSocketOption(QAbstractSocket::MulticastLoopbackOption,
+			QVariant::fromValue<bool>(true));
+		socket->setMulticastInterface(iface);
+		connect(socket, &QUdpSocket::readyRead, this, &DeviceDiscoveryWorker::processResponse);
+
+		endpoints.append(Endpoint{ socket, iface.index(), group });
+		qDebug() << "Joined" << group.toString() << "on interface:" << iface.humanReadableName();
+		return true;
+	}
+
+	void DeviceDiscoveryWorker::closeEndpoints()
+	{
+		for (const Endpoint& endpoint : std::as_const(endpoints))
+			endpoint.socket->deleteLater(); // May be the sender of the slot running right now
+		endpoints.clear();
+	}
+
+	void DeviceDiscoveryWorker::sendQueries(const QList<MdnsRecordCache::Question>& questions)
+	{
+		// One datagram per MTU's worth of questions instead of one per question; names are
+		// compressed and questions still in flight are dropped. Every interface gets the same packets.
+		const QList<QByteArray> packets = queryCoalescer.build(questions, recordCache, cacheClock.elapsed());
+		for (const QByteArray& packet : packets) {
+			qDebug() << "Sending mDNS query packet," << packet.size() << "bytes for" << questions.size() << "questions";
+			qDebug() << "Outgoing mDNS packet (hex):" << packet.toHex();
+			for (const Endpoint& endpoint : std::as_const(endpoints))
+				endpoint.socket->writeDatagram(packet, endpoint.group, 5353);
+		}
+	}
+
+	void DeviceDiscoveryWorker::processResponse()
+	{
+		QUdpSocket* socket = qobject_cast<QUdpSocket*>(sender());
+		const auto endpoint = std::find_if(endpoints.cbegin(), endpoints.cend(), [socket](const Endpoint& candidate)
+			{
+				return candidate.socket == socket;
+			});
+		if (endpoint == endpoints.cend())
+			return;
+
+		while (socket->hasPendingDatagrams()) {
+			const QNetworkDatagram datagram = socket->receiveDatagram();
+			const QHostAddress sender = datagram.senderAddress();
+
+			// Sockets sharing port 5353 may all see a multicast packet that arrived on another
+			// interface; only the socket of the arrival interface handles it. Unicast replies to
+			// warm-start probes land on just one of the sockets.
+			const int arrival = datagram.interfaceIndex() != 0 ? int(datagram.interfaceIndex()) : endpoint->interfaceIndex;
+			if (datagram.destinationAddress().isMulticast() && arrival != endpoint->interfaceIndex)
+				continue;
+
+			// Our own queries loop back, and so do answers from other programs on this host
+			if (NetworkInterfaceMonitor::instance()->isLocalAddress(sender) || datagram.data().size() < 20) {
+				qDebug() << "Skipping response from" << sender.toString();
+				continue;
+			}
+
+			qDebug() << "Received mDNS response from" << sender.toString();
+			qDebug() << "Incoming datagram (hex):" << datagram.data().toHex();
+
+			parseDnsResponse(datagram.data(), sender, arrival);
+		}
+	}
+
+	void DeviceDiscoveryWorker::parseDnsResponse(const QByteArray& data, const QHostAddress& sender, int interfaceIndex)
+	{
+		MdnsMessage message;
+		if (!message.parse(data)) {
+			qDebug() << "Dropping malformed mDNS packet from" << sender.toString() << ":" << message.errorString();
+			return;
+		}
+
+		// Records already in the cache only have their TTL renewed, so PTR and SRV follow-ups
+		// happen once per record rather than once per announcement
+		const QList<MdnsRecordCache::Change> changes = recordCache.ingest(message, cacheClock.elapsed());
+		for (const MdnsRecordCache::Change& change : changes)
+			handleRecordChange(change, sender, interfaceIndex);
+		scheduleCacheMaintenance();
+	}
+
+	void DeviceDiscoveryWorker::handleRecordChange(const MdnsRecordCache::Change& change, const QHostAddress& sender, int interfaceIndex)
+	{
+		const MdnsRecordCache::Record& record = change.record;
+		const bool added = change.kind == MdnsRecordCache::ChangeKind::Added;
+
+		if (record.type == Dns::PTR) {
+			const QString serviceName = QString::fromUtf8(record.target);
+			if (!isCastingService(QString::fromUtf8(record.name), serviceName))
+				return;
+			if (!added) {
+				forgetInstance(record.target);
+				return;
+			}
+
+			const QByteArray key = record.target.toLower();
+			const auto existing = instances.constFind(key);
+			if (existing != instances.constEnd()) {
+				// Known already, unless it is only remembered from the last run: this answer confirms it
+				DeviceInfo known;
+				if (lookupDevice(existing->deviceId, known) && known.verified)
+					return;
+			}
+			qDebug() << "PTR record points to:" << serviceName;
+			Instance& instance = instances[key];
+			instance.name = record.target;
+			instance.sender = sender;
+			instance.interfaceIndex = interfaceIndex;
+			queryScheduler->queryOnce(record.target, Dns::SRV);
+			queryScheduler->queryOnce(record.target, Dns::TXT);
+			resolveInstance(instance);
+			return;
+		}
+
+		if (record.type == Dns::SRV && added && recordCache.records(record.target, Dns::A).isEmpty()) {
+			queryScheduler->queryOnce(record.target, Dns::A);
+			queryScheduler->queryOnce(record.target, Dns::AAAA);
+		}
+
+		// SRV and TXT belong to the instance itself, addresses to the host its SRV points at
+		const auto own = instances.find(record.name.toLower());
+		if (own != instances.end()) {
+			resolveInstance(own.value());
+			return;
+		}
+		if (record.type == Dns::A || record.type == Dns::AAAA) {
+			for (Instance& instance : instances) {
+				const QList<MdnsRecordCache::Record> srv = recordCache.records(instance.name, Dns::SRV);
+				if (!srv.isEmpty() && srv.first().target.compare(record.name, Qt::CaseInsensitive) == 0)
+					resolveInstance(instance);
+			}
+		}
+	}
+
+	bool DeviceDiscoveryWorker::isInstanceHost(const QByteArray& hostName) const
+	{
+		for (const Instance& instance : instances) {
+			const QList<MdnsRecordCache::Record> srv = recordCache.records(instance.name, Dns::SRV);
+			if (!srv.isEmpty() && srv.first().target.compare(hostName, Qt::CaseInsensitive) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	void DeviceDiscoveryWorker::resolveInstance(Instance& instance)
+	{
+		// What we knew before fills in for records that have not been heard (yet)
+		DeviceInfo previous;
+		const bool known = !instance.deviceId.isEmpty() && lookupDevice(instance.deviceId, previous);
+
+		DeviceInfo device;
+		device.serviceName = QString::fromUtf8(instance.name);
+		device.kind = instance.name.toLower().endsWith("_airplay._tcp.local.") ? DeviceInfo::Kind::AirPlay : DeviceInfo::Kind::Cast;
+		device.name = extractDeviceName(device.serviceName);
+		device.address = instance.sender;
+		device.interfaceIndex = instance.interfaceIndex;
+
+		const QList<MdnsRecordCache::Record> srv = recordCache.records(instance.name, Dns::SRV);
+		if (srv.isEmpty() && known)
+			device.port = previous.port;
+		if (!srv.isEmpty()) {
+			device.port = qFromBigEndian<quint16>(srv.first().rdata.constData() + 4);
+			const QList<MdnsRecordCache::Record> ipv4 = recordCache.records(srv.first().target, Dns::A);
+			const QList<MdnsRecordCache::Record> ipv6 = recordCache.records(srv.first().target, Dns::AAAA);
+			if (!ipv4.isEmpty() && ipv4.first().rdata.size() == 4)
+				device.address = QHostAddress(qFromBigEndian<quint32>(ipv4.first().rdata.constData()));
+			else if (!ipv6.isEmpty() && ipv6.first().rdata.size() == 16)
+				device.address = QHostAddress(reinterpret_cast<const quint8*>(ipv6.first().rdata.constData()));
+		}
+		// A link-local address is only usable together with the interface it was heard on
+		if (device.address.protocol() == QAbstractSocket::IPv6Protocol && device.address.isLinkLocal() &&
+			device.address.scopeId().isEmpty())
+			device.address.setScopeId(QNetworkInterface::interfaceNameFromIndex(instance.interfaceIndex));
+
+		// Cast: id, fn (friendly name), md (model), ca (capability bits). AirPlay: deviceid, model, features.
+		const QList<MdnsRecordCache::Record> txt = recordCache.records(instance.name, Dns::TXT);
+		if (txt.isEmpty() && known) {
+			device.id = previous.id;
+			device.name = previous.name;
+			device.model = previous.model;
+			device.capabilities = previous.capabilities;
+		}
+		const QByteArray entries = txt.isEmpty() ? QByteArray() : txt.first().rdata;
+		for (qsizetype pos = 0; pos < entries.size();) {
+			const qsizetype length = quint8(entries[pos]);
+			const QByteArray entry = entries.mid(pos + 1, length);
+			pos += 1 + length;
+			const qsizetype equals = entry.indexOf('=');
+			if (equals <= 0)
+				continue;
+			const QByteArray key = entry.left(equals).toLower();
+			const QString value = QString::fromUtf8(entry.mid(equals + 1));
+			if (value.isEmpty())
+				continue;
+			if (key == "id" || key == "deviceid")
+				device.id = value;
+			else if (key == "fn")
+				device.name = value;
+			else if (key == "md" || key == "model")
+				device.model = value;
+			else if (key == "ca")
+				device.capabilities = castCapabilities(value.toUInt());
+			else if (key == "features")
+				device.capabilities = { "features=" + value };
+		}
+		if (device.id.isEmpty())
+			device.id = device.serviceName;
+
+		if (!instance.deviceId.isEmpty() && instance.deviceId != device.id)
+			unpublish(instance.deviceId);
+		if (!known || !previous.verified)
+			qDebug() << "*** DISCOVERED CASTING DEVICE:" << device.name << "at" << device.address.toString();
+		instance.deviceId = device.id;
+		publish(device);
+	}
+
+	void DeviceDiscoveryWorker::probeStoredDevices()
+	{
+		// Warm start: ask every device remembered from the last run directly for its SRV and TXT
+		// records. Any answer confirms it through resolveInstance(); silence drops it.
+		bool probing = false;
+		const qint64 now = cacheClock.elapsed();
+		for (const DevicePtr& device : DeviceRegistry::instance()->snapshot()) {
+			if (device->verified || device->kind == DeviceInfo::Kind::Dlna || device->serviceName.isEmpty())
+				continue;
+
+			const QByteArray name = device->serviceName.toUtf8();
+			Instance& instance = instances[name.toLower()];
+			instance.name = name;
+			instance.deviceId = device->id;
+			instance.sender = device->address;
+			instance.interfaceIndex = device->interfaceIndex;
+
+			// Same family, and the interface it was found on if that one is still around
+			const Endpoint* via = nullptr;
+			for (const Endpoint& endpoint : std::as_const(endpoints)) {
+				if (endpoint.group.protocol() != device->address.protocol())
+					continue;
+				if (!via || endpoint.interfaceIndex == device->interfaceIndex)
+					via = &endpoint;
+			}
+			if (!via)
+				continue;
+
+			const QList<MdnsRecordCache::Question> questions = { { name, Dns::SRV }, { name, Dns::TXT } };
+			for (const QByteArray& packet : MdnsQueryCoalescer().build(questions, recordCache, now))
+				via->socket->writeDatagram(packet, device->address, 5353);
+			qDebug() << "Probing remembered device" << device->name << "at" << device->address.toString();
+			probing = true;
+		}
+		if (probing)
+			QTimer::singleShot(ProbeTimeoutMs, this, &DeviceDiscoveryWorker::dropUnconfirmedDevices);
+	}
+
+	void DeviceDiscoveryWorker::dropUnconfirmedDevices()
+	{
+		if (!running)
+			return;
+		// Answers confirmed since the last flush are only in pendingUpdates, hence lookupDevice()
+		for (const DevicePtr& stored : DeviceRegistry::instance()->snapshot()) {
+			DeviceInfo device;
+			if (!lookupDevice(stored->id, device) || device.verified || device.kind == DeviceInfo::Kind::Dlna)
+				continue;
+			qDebug() << "Remembered device did not answer:" << device.name;
+			const QByteArray key = device.serviceName.toUtf8().toLower();
+			if (instances.value(key).deviceId == device.id)
+				instances.remove(key);
+			unpublish(device.id);
+		}
+	}
+
+	void DeviceDiscoveryWorker::forgetInstance(const QByteArray& name)
+	{
+		const Instance instance = instances.take(name.toLower());
+		if (instance.deviceId.isEmpty())
+			return;
+		qDebug() << "*** CASTING DEVICE GONE:" << instance.deviceId;
+		unpublish(instance.deviceId);
+	}
+
+	bool DeviceDiscoveryWorker::lookupDevice(const QString& id, DeviceInfo& device) const
+	{
+		if (pendingRemovals.contains(id))
+			return false;
+		const auto pending = pendingUpdates.constFind(id);
+		if (pending != pendingUpdates.constEnd()) {
+			device = pending.value();
+			return true;
+		}
+		const DevicePtr published = DeviceRegistry::instance()->device(id);
+		if (!published)
+			return false;
+		device = *published;
+		return true;
+	}
+
+	void DeviceDiscoveryWorker::publish(const DeviceInfo& device)
+	{
+		pendingRemovals.remove(device.id);
+		pendingUpdates.insert(device.id, device);
+		if (!flushTimer->isActive())
+			flushTimer->start();
+	}
+
+	void DeviceDiscoveryWorker::unpublish(const QString& id)
+	{
+		pendingUpdates.remove(id);
+		pendingRemovals.insert(id);
+		if (!flushTimer->isActive())
+			flushTimer->start();
+	}
+
+	void DeviceDiscoveryWorker::flushDevices()
+	{
+		flushTimer->stop();
+		if (pendingUpdates.isEmpty() && pendingRemovals.isEmpty())
+			return;
+		// One registry write, hence one queued Delta for the UI, per burst of answers
+		DeviceRegistry::instance()->apply(pendingUpdates.values(), QStringList(pendingRemovals.cbegin(), pendingRemovals.cend()));
+		pendingUpdates.clear();
+		pendingRemovals.clear();
+	}
+
+	void DeviceDiscoveryWorker::maintainCache()
+	{
+		const qint64 now = cacheClock.elapsed();
+		for (const MdnsRecordCache::Change& change : recordCache.expire(now))
+			handleRecordChange(change, QHostAddress(), 0);
+
+		// Only re-ask for what belongs to the casting services, including the A/AAAA records of
+		// the hosts their SRVs point at; other chatter on the link is cached for the known-answer
+		// lists but not kept alive
+		for (const MdnsRecordCache::Question& question : recordCache.takeDueRefreshes(now)) {
+			if (question.name.endsWith("_googlecast._tcp.local.") || question.name.endsWith("_airplay._tcp.local.")
+				|| isInstanceHost(question.name))
+				queryScheduler->queryOnce(question.name, question.type);
+		}
+		scheduleCacheMaintenance();
+	}
+
+	void DeviceDiscoveryWorker::scheduleCacheMaintenance()
+	{
+		const qint64 deadline = recordCache.nextDeadline();
+		if (deadline < 0) {
+			cacheTimer->stop();
+			return;
+		}
+		const qint64 delay = qBound<qint64>(0, deadline - cacheClock.elapsed(), std::numeric_limits<int>::max());
+		cacheTimer->start(int(delay));
+	}
+
+	void DeviceDiscoveryWorker::printNetworkInterfaces()
+	{
+		// Print available network interfaces for debugging
+		const auto ifs = NetworkInterfaceMonitor::instance()->interfaces();
+		for (const auto& iface : ifs) {
+			qDebug() << "Interface:" << iface.humanReadableName();
+		}
+	}
+
+	bool DeviceDiscoveryWorker::isCastingService(const QString& serviceType, const QString& serviceName) const
+	{
+		// Check if the serviceType matches known casting services
+		return serviceType.startsWith("_googlecast._tcp.local.") || serviceType.startsWith("_airplay._tcp.local.");
+	}
+
+	QString DeviceDiscoveryWorker::extractDeviceName(const QString& fullName) const
+	{
+		// Extract device name from full service name, e.g. "MyDevice._googlecast._tcp.local." => "MyDevice"
+		QStringList parts = fullName.split('.');
+		if (!parts.isEmpty()) {
+			return parts.first();
+		}
+		return QString();
+	}
+
+} // namespace CastIt
+
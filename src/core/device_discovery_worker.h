@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QNetworkInterface>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QUdpSocket>
+#include "device_registry.h"
+#include "mdns_query_coalescer.h"
+#include "mdns_query_scheduler.h"
+#include "mdns_record_cache.h"
+
+namespace CastIt
+{
+	// The mDNS side of discovery. Lives on DeviceDiscovery's thread together with everything it
+	// owns (sockets, timers, record cache), so receiving and parsing never touch the GUI thread.
+	// Results leave in batches through DeviceRegistry::apply(), at most once per FlushDelayMs.
+	class DeviceDiscoveryWorker : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		static constexpr int FlushDelayMs = 100; // Long enough to gather one burst of answers
+		static constexpr int ProbeTimeoutMs = 3000; // For devices remembered from the last run to answer
+
+		explicit DeviceDiscoveryWorker(QObject* parent = nullptr);
+
+	public slots:
+		void start(); // Opens the sockets and starts querying; call on the worker's thread
+		void stop(); // Closes everything down and publishes what is still pending
+
+	signals:
+		void discoveryError(const QString& error);
+
+	private slots:
+		void sendQueries(const QList<CastIt::MdnsRecordCache::Question>& questions);
+		void processResponse();
+		void maintainCache();
+		void onInterfacesChanged();
+		void dropUnconfirmedDevices();
+		void flushDevices();
+
+	private:
+		// A casting service instance seen in a PTR answer, published to the DeviceRegistry
+		struct Instance
+		{
+			QByteArray name; // As announced, e.g. "Living-Room-TV._googlecast._tcp.local."
+			QString deviceId; // Under which it is registered, empty until resolved
+			QHostAddress sender; // Address of the announcer, until an A/AAAA record is known
+			int interfaceIndex = 0; // Where its PTR answer arrived
+		};
+
+		// One mDNS socket, bound to port 5353 for one interface and address family
+		struct Endpoint
+		{
+			QUdpSocket* socket;
+			int interfaceIndex;
+			QHostAddress group; // 224.0.0.251 or ff02::fb
+		};
+
+		static const QHostAddress MdnsGroupIpv4;
+		static const QHostAddress MdnsGroupIpv6;
+
+		bool running = false;
+		QList<Endpoint> endpoints;
+		MdnsQueryScheduler* queryScheduler;
+		QHash<QByteArray, Instance> instances; // By lowercased service instance name
+		MdnsRecordCache recordCache;
+		MdnsQueryCoalescer queryCoalescer;
+		QElapsedTimer cacheClock;
+		QTimer* cacheTimer; // Fires at the next record expiry or refresh
+		QTimer* flushTimer;
+		QHash<QString, DeviceInfo> pendingUpdates; // Not yet handed to the registry, by device id
+		QSet<QString> pendingRemovals;
+
+		void parseDnsResponse(const QByteArray& data, const QHostAddress& sender, int interfaceIndex);
+		void handleRecordChange(const MdnsRecordCache::Change& change, const QHostAddress& sender, int interfaceIndex);
+		void scheduleCacheMaintenance();
+		void resolveInstance(Instance& instance);
+		void forgetInstance(const QByteArray& name);
+		bool isInstanceHost(const QByteArray& hostName) const; // Target of a known instance's SRV
+		void probeStoredDevices();
+
+		// The registry as it will be after the next flush
+		bool lookupDevice(const QString& id, DeviceInfo& device) const;
+		void publish(const DeviceInfo& device);
+		void unpublish(const QString& id);
+
+		bool openEndpoints(); // False, with discoveryError emitted, if no interface could be joined
+		bool openEndpoint(const QNetworkInterface& iface, bool ipv6, QString& error);
+		void closeEndpoints();
+		void printNetworkInterfaces();
+		bool isCastingService(const QString& name, const QString& serviceName) const;
+		QString extractDeviceName(const QString& serviceName) const;
+	};
+}
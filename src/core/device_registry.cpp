@@ -0,0 +1,251 @@
+#include "device_registry.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr int StoreVersion = 1;
+
+		QJsonObject toJson(const DeviceInfo& device, qint64 seen)
+		{
+			return QJsonObject{
+				{ "id", device.id },
+				{ "kind", int(device.kind) },
+				{ "name", device.name },
+				{ "model", device.model },
+				{ "service", device.serviceName },
+				{ "address", device.address.toString() },
+				{ "port", device.port },
+				{ "interface", device.interfaceIndex },
+				{ "control", device.controlUrl },
+				{ "capabilities", QJsonArray::fromStringList(device.capabilities) },
+				{ "formats", QJsonArray::fromStringList(device.formats) },
+				{ "seen", seen } };
+		}
+
+		DeviceInfo fromJson(const QJsonObject& entry)
+		{
+			DeviceInfo device;
+			device.id = entry.value("id").toString();
+			device.kind = DeviceInfo::Kind(qBound(0, entry.value("kind").toInt(), int(DeviceInfo::Kind::Dlna)));
+			device.name = entry.value("name").toString();
+			device.model = entry.value("model").toString();
+			device.serviceName = entry.value("service").toString();
+			device.address = QHostAddress(entry.value("address").toString());
+			device.port = quint16(entry.value("port").toInt());
+			device.interfaceIndex = entry.value("interface").toInt();
+			device.controlUrl = entry.value("control").toString();
+			for (const QJsonValue& capability : entry.value("capabilities").toArray())
+				device.capabilities.append(capability.toString());
+			for (const QJsonValue& format : entry.value("formats").toArray())
+				device.formats.append(format.toString());
+			device.verified = false;
+			return device;
+		}
+	}
+
+	QString DeviceInfo::displayName() const
+	{
+		const QString suffix = verified ? QString() : QString(" (unverified)");
+		switch (kind)
+		{
+		case Kind::Cast:
+			return "Chromecast: " + name + suffix;
+		case Kind::AirPlay:
+			return "AirPlay: " + name + suffix;
+		case Kind::Dlna:
+			return "DLNA: " + name + suffix;
+		}
+		return name + suffix;
+	}
+
+	bool DeviceInfo::acceptsFormat(const QByteArray& mimeType) const
+	{
+		if (formats.isEmpty())
+			return true;
+		const QString type = QString::fromLatin1(mimeType);
+		const QString major = type.section('/', 0, 0) + "/*";
+		for (const QString& format : formats)
+		{
+			if (format == "*" || format.compare(type, Qt::CaseInsensitive) == 0 || format.compare(major, Qt::CaseInsensitive) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	DeviceRegistry* DeviceRegistry::instance()
+	{
+		// Parented to the application so it is torn down with the event loop, not after it
+		static DeviceRegistry* registry = new DeviceRegistry(QCoreApplication::instance());
+		return registry;
+	}
+
+	DeviceRegistry::DeviceRegistry(QObject* parent) : QObject(parent),
+		saveTimer(new QTimer(this))
+	{
+		qRegisterMetaType<CastIt::DevicePtr>();
+		qRegisterMetaType<CastIt::DeviceRegistry::Delta>();
+		saveTimer->setSingleShot(true);
+		saveTimer->setInterval(SaveDelayMs);
+		connect(saveTimer, &QTimer::timeout, this, &DeviceRegistry::save);
+		if (QCoreApplication::instance())
+			connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &DeviceRegistry::save);
+	}
+
+	DeviceRegistry::Snapshot DeviceRegistry::snapshot() const
+	{
+		QMutexLocker locker(&mutex);
+		return devices;
+	}
+
+	DevicePtr DeviceRegistry::device(const QString& id) const
+	{
+		QMutexLocker locker(&mutex);
+		return devices.value(id);
+	}
+
+	void DeviceRegistry::update(const DeviceInfo& device)
+	{
+		apply({ device }, {});
+	}
+
+	void DeviceRegistry::remove(const QString& id)
+	{
+		apply({}, { id });
+	}
+
+	void DeviceRegistry::apply(const QList<DeviceInfo>& updates, const QStringList& removals)
+	{
+		Delta delta;
+		{
+			QMutexLocker locker(&mutex);
+			const qint64 now = QDateTime::currentMSecsSinceEpoch();
+			for (const DeviceInfo& device : updates)
+			{
+				if (device.id.isEmpty())
+					continue;
+				if (device.verified)
+					lastSeen.insert(device.id, now);
+				const DevicePtr current = devices.value(device.id);
+				if (current && *current == device)
+					continue;
+				const DevicePtr published = std::make_shared<const DeviceInfo>(device);
+				devices.insert(device.id, published);
+				(current ? delta.changed : delta.added).append(published);
+			}
+			for (const QString& id : removals)
+			{
+				if (!devices.remove(id))
+					continue;
+				lastSeen.remove(id);
+				delta.removed.append(id);
+			}
+		}
+
+		if (delta.isEmpty())
+			return;
+		emit devicesChanged(delta);
+		scheduleSave();
+	}
+
+	void DeviceRegistry::scheduleSave()
+	{
+		// Writers may be on any thread, the timer belongs to this one
+		QMetaObject::invokeMethod(saveTimer, qOverload<>(&QTimer::start), Qt::AutoConnection);
+	}
+
+	void DeviceRegistry::setStorePath(const QString& path)
+	{
+		QMutexLocker locker(&mutex);
+		storePath = path;
+	}
+
+	QString DeviceRegistry::storeFile() const
+	{
+		return storePath.isEmpty() ? QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/devices.json" : storePath;
+	}
+
+	int DeviceRegistry::restore()
+	{
+		QString path;
+		{
+			QMutexLocker locker(&mutex);
+			path = storeFile();
+		}
+		QFile file(path);
+		if (!file.open(QIODevice::ReadOnly))
+			return 0;
+
+		const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+		if (root.value("version").toInt() != StoreVersion)
+			return 0;
+
+		const qint64 now = QDateTime::currentMSecsSinceEpoch();
+		Delta restored;
+		{
+			QMutexLocker locker(&mutex);
+			for (const QJsonValue& value : root.value("devices").toArray())
+			{
+				const QJsonObject entry = value.toObject();
+				const qint64 seen = entry.value("seen").toInteger();
+				const DeviceInfo device = fromJson(entry);
+				if (device.id.isEmpty() || device.address.isNull() || now - seen > MaxStoredAgeMs || devices.contains(device.id))
+					continue;
+				const DevicePtr published = std::make_shared<const DeviceInfo>(device);
+				devices.insert(device.id, published);
+				lastSeen.insert(device.id, seen);
+				restored.added.append(published);
+			}
+		}
+		if (!restored.isEmpty())
+			emit devicesChanged(restored);
+		qDebug() << "Restored" << restored.added.size() << "known devices from" << path;
+		return restored.added.size();
+	}
+
+	void DeviceRegistry::save() const
+	{
+		QString path;
+		QList<QPair<qint64, DevicePtr>> entries;
+		{
+			QMutexLocker locker(&mutex);
+			path = storeFile();
+			for (const DevicePtr& device : devices)
+				entries.append({ lastSeen.value(device->id), device });
+		}
+
+		// Most recently seen first, so the cap drops the stalest
+		std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		QJsonArray array;
+		for (const auto& [seen, device] : entries)
+		{
+			if (array.size() == MaxStoredDevices)
+				break;
+			array.append(toJson(*device, seen));
+		}
+
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QSaveFile file(path);
+		if (!file.open(QIODevice::WriteOnly))
+		{
+			qWarning() << "Cannot write device cache" << path << ":" << file.errorString();
+			return;
+		}
+		file.write(QJsonDocument(QJsonObject{ { "version", StoreVersion }, { "devices", array } }).toJson(QJsonDocument::Compact));
+		if (!file.commit())
+			qWarning() << "Cannot write device cache" << path << ":" << file.errorString();
+	}
+}
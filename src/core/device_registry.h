@@ -0,0 +1,104 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <memory>
+
+namespace CastIt
+{
+	// Everything discovery knows about one renderer. Published as immutable shared snapshots,
+	// so a DeviceInfo handed out once never changes underneath its reader.
+	struct DeviceInfo
+	{
+		enum class Kind
+		{
+			Cast,
+			AirPlay,
+			Dlna
+		};
+
+		QString id; // TXT id / deviceid for mDNS, UDN for DLNA; falls back to the service name
+		Kind kind = Kind::Cast;
+		QString name; // Friendly name shown to the user
+		QString model;
+		QString serviceName; // mDNS instance name or SSDP LOCATION
+		QHostAddress address;
+		quint16 port = 0;
+		int interfaceIndex = 0; // Local interface it was discovered on, 0 if unknown
+		QString controlUrl; // DLNA AVTransport control URL
+		QStringList capabilities; // Cast "ca" flags, AirPlay features, DLNA service names
+		QStringList formats; // MIME types a DLNA renderer accepts (GetProtocolInfo Sink), empty if unknown
+		bool verified = true; // False for entries restored from disk until discovery confirms them
+
+		QString displayName() const;
+		bool acceptsFormat(const QByteArray& mimeType) const; // True as long as formats are unknown
+		bool operator==(const DeviceInfo& other) const = default;
+	};
+
+	using DevicePtr = std::shared_ptr<const DeviceInfo>;
+
+	// Process-wide set of known devices, keyed by stable id so two devices sharing a friendly
+	// name stay apart. Writers call update()/remove()/apply() from any thread; listeners get only
+	// what changed, one Delta per call, delivered on their own thread. The set is kept on disk,
+	// so the next launch can list (and cast to) known devices before discovery has heard from them.
+	class DeviceRegistry : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		using Snapshot = QHash<QString, DevicePtr>; // Implicitly shared, cheap to copy around
+
+		// What one write changed; a discovery burst arrives as one Delta, not a signal per device
+		struct Delta
+		{
+			QList<DevicePtr> added;
+			QList<DevicePtr> changed;
+			QStringList removed;
+
+			bool isEmpty() const { return added.isEmpty() && changed.isEmpty() && removed.isEmpty(); }
+		};
+
+		static constexpr int MaxStoredDevices = 256;
+		static constexpr qint64 MaxStoredAgeMs = 30LL * 24 * 3600 * 1000; // Not seen for a month: forgotten
+		static constexpr int SaveDelayMs = 2000; // Changes come in bursts during discovery
+
+		static DeviceRegistry* instance(); // Created on first use, lives until the application quits
+
+		Snapshot snapshot() const;
+		DevicePtr device(const QString& id) const;
+
+		void update(const DeviceInfo& device); // Adds, or replaces if anything differs
+		void remove(const QString& id);
+		void apply(const QList<DeviceInfo>& updates, const QStringList& removals); // Both at once, as one Delta
+
+		void setStorePath(const QString& path); // Defaults to devices.json in the cache location
+		// Adds the devices saved by the last run as unverified, before discovery starts. Returns how many.
+		int restore();
+		void save() const;
+
+	signals:
+		void devicesChanged(const CastIt::DeviceRegistry::Delta& delta);
+
+	private:
+		explicit DeviceRegistry(QObject* parent = nullptr);
+
+		mutable QMutex mutex;
+		Snapshot devices;
+		QHash<QString, qint64> lastSeen; // Ms since epoch of the last update() per id
+		QString storePath;
+		QTimer* saveTimer;
+
+		void scheduleSave();
+		QString storeFile() const;
+	};
+}
+
+Q_DECLARE_METATYPE(CastIt::DevicePtr)
+Q_DECLARE_METATYPE(CastIt::DeviceRegistry::Delta)
@@ -1,11 +1,11 @@
 #include "dlna_controller.h"
+#include "media_server.h"
+#include "media_probe.h"
 #include <QDebug>
-#include <QTcpServer>
-#include <QTcpSocket>
-#include <QUrl>
-#include <QFile>
 #include <QHostAddress>
-#include <QNetworkInterface>
+#include <QUrl>
+#include <QSet>
+#include <utility>
 
 namespace CastIt
 {
@@ -15,108 +15,98 @@ namespace CastIt
 
     DlnaController::~DlnaController()
     {
+        // Renderers still playing lose their stream with us anyway
+        const QList<QString> tokens = sessions.values();
+        for (const QString& token : QSet<QString>(tokens.cbegin(), tokens.cend()))
+            MediaServer::instance()->unpublish(token);
     }
 
     void DlnaController::castMedia(const QString& controlUrl, const QString& mediaPath)
     {
-        startLocalServer(mediaPath);
+        castMediaToRenderers(QStringList{ controlUrl }, mediaPath);
+    }
 
-        // Set AVTransportURI
-        QString setUriBody = "<u:SetAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
-            "<InstanceID>0</InstanceID>"
-            "<CurrentURI>" + localMediaUrl + "</CurrentURI>"
-            "<CurrentURIMetaData></CurrentURIMetaData>"
-            "</u:SetAVTransportURI>";
-        
-        sendSoapAction(controlUrl, "SetAVTransportURI", setUriBody);
+    void DlnaController::castMediaToRenderers(const QStringList& controlUrls, const QString& mediaPath)
+    {
+        // Several renderers share one sequential read of the file through a fan-out publication
+        const QString token = publishMedia(mediaPath, controlUrls.size() > 1);
+        if (token.isEmpty())
+            return;
 
         // Play SOAP action body
-        QString playBody = "<u:Play xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+        const QString playBody = "<u:Play xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
             "<InstanceID>0</InstanceID>"
             "<Speed>1</Speed>"
             "</u:Play>";
-        
-        sendSoapAction(controlUrl, "Play", playBody);
-    }
 
-    void DlnaController::startLocalServer(const QString& mediaPath)
-    {
-        QTcpServer* server = new QTcpServer(this);
-        
-        // Get the first available network interface IP
-        QString localIp = "127.0.0.1";
-        QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
-        for (const QNetworkInterface& interface : interfaces)
+        // All renderers are set up in parallel; each one only gets Play once it accepted the URI
+        for (const QString& controlUrl : controlUrls)
         {
-            if (interface.flags() & QNetworkInterface::IsUp && 
-                interface.flags() & QNetworkInterface::IsRunning &&
-                !(interface.flags() & QNetworkInterface::IsLoopBack))
+            // This renderer's previous session is replaced; other renderers keep playing theirs
+            retireSession(controlUrl);
+            sessions.insert(controlUrl, token);
+
+            // Each renderer gets the URL under one of our addresses on its own network
+            const QString mediaUrl = MediaServer::instance()->urlFor(token, QHostAddress(QUrl(controlUrl).host()));
+            const QString setUriBody = "<u:SetAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+                "<InstanceID>0</InstanceID>"
+                "<CurrentURI>" + mediaUrl + "</CurrentURI>"
+                "<CurrentURIMetaData></CurrentURIMetaData>"
+                "</u:SetAVTransportURI>";
+
+            sendSoapAction(controlUrl, "SetAVTransportURI", setUriBody, [this, controlUrl, playBody](bool ok)
             {
-                QList<QNetworkAddressEntry> entries = interface.addressEntries();
-                for (const QNetworkAddressEntry& entry : entries)
-                {
-                    if (entry.ip().protocol() == QAbstractSocket::IPv4Protocol)
-                    {
-                        localIp = entry.ip().toString();
-                        break;
-                    }
-                }
-                if (localIp != "127.0.0.1") break;
-            }
+                if (ok)
+                    sendSoapAction(controlUrl, "Play", playBody);
+            });
         }
+    }
 
-        if (server->listen(QHostAddress::Any, 0))
+    void DlnaController::stop(const QString& controlUrl)
+    {
+        const QString stopBody = "<u:Stop xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+            "<InstanceID>0</InstanceID>"
+            "</u:Stop>";
+        sendSoapAction(controlUrl, "Stop", stopBody);
+        retireSession(controlUrl);
+    }
+
+    void DlnaController::retireSession(const QString& controlUrl)
+    {
+        // A fan-out token stays published as long as any renderer of its group still uses it
+        const QString token = sessions.take(controlUrl);
+        if (token.isEmpty())
+            return;
+        for (const QString& other : std::as_const(sessions))
         {
-            localMediaUrl = QString("http://%1:%2/media").arg(localIp).arg(server->serverPort());
-            qDebug() << "Started local media server at:" << localMediaUrl;
-            
-            connect(server, &QTcpServer::newConnection, [server, mediaPath, this]()
-            {
-                QTcpSocket* socket = server->nextPendingConnection();
-                
-                connect(socket, &QTcpSocket::readyRead, [socket, mediaPath]()
-                {
-                    QByteArray request = socket->readAll();
-                    qDebug() << "HTTP request:" << request.left(200);
-                    
-                    QFile file(mediaPath);
-                    if (file.open(QIODevice::ReadOnly))
-                    {
-                        QString mimeType = "video/mp4"; // Default
-                        if (mediaPath.endsWith(".mp3", Qt::CaseInsensitive))
-                            mimeType = "audio/mpeg";
-                        else if (mediaPath.endsWith(".mkv", Qt::CaseInsensitive))
-                            mimeType = "video/x-matroska";
-                        else if (mediaPath.endsWith(".avi", Qt::CaseInsensitive))
-                            mimeType = "video/x-msvideo";
-
-                        QString header = QString("HTTP/1.1 200 OK\r\n"
-                            "Content-Type: %1\r\n"
-                            "Content-Length: %2\r\n"
-                            "Accept-Ranges: bytes\r\n"
-                            "Connection: close\r\n"
-                            "\r\n").arg(mimeType).arg(file.size());
-                        
-                        socket->write(header.toUtf8());
-                        socket->write(file.readAll());
-                        file.close();
-                    }
-                    else
-                    {
-                        QString response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
-                        socket->write(response.toUtf8());
-                    }
-                    socket->disconnectFromHost();
-                });
-            });
+            if (other == token)
+                return;
         }
-        else
+        MediaServer::instance()->unpublish(token);
+    }
+
+    QString DlnaController::publishMedia(const QString& mediaPath, bool fanout)
+    {
+        // The container decides the type, not the extension; renderers reject files announced wrongly
+        const MediaInfo mediaInfo = MediaProbe::instance().probe(mediaPath);
+        const QByteArray mimeType = mediaInfo.mimeType;
+        qDebug() << "Probed" << mediaPath << ":" << mediaInfo.container << mimeType << mediaInfo.codecs
+            << mediaInfo.durationMs << "ms";
+
+        // The shared server outlives every cast; tokens are retired per renderer, see retireSession()
+        MediaServer* server = MediaServer::instance();
+        const QString token = server->publish(mediaPath, mimeType, fanout);
+        if (token.isEmpty())
         {
             emit castingError("Failed to start local server: " + server->errorString());
+            return QString();
         }
+        qDebug() << "Serving media at:" << server->urlFor(token);
+        return token;
     }
 
-    void DlnaController::sendSoapAction(const QString& controlUrl, const QString& action, const QString& body)
+    void DlnaController::sendSoapAction(const QString& controlUrl, const QString& action, const QString& body,
+        std::function<void(bool)> onFinished)
     {
         QNetworkRequest request((QUrl(controlUrl)));
         request.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml; charset=\"utf-8\"");
@@ -132,9 +122,10 @@ namespace CastIt
         qDebug() << "SOAP envelope:" << soapEnvelope;
 
         QNetworkReply* reply = networkManager->post(request, soapEnvelope.toUtf8());
-        connect(reply, &QNetworkReply::finished, [reply, action, this]()
+        connect(reply, &QNetworkReply::finished, [reply, action, onFinished, this]()
         {
-            if (reply->error() == QNetworkReply::NoError)
+            const bool ok = reply->error() == QNetworkReply::NoError;
+            if (ok)
             {
                 qDebug() << "SOAP action" << action << "successful";
                 emit castingStatus(QString("SOAP action %1 successful").arg(action));
@@ -146,6 +137,9 @@ namespace CastIt
                 emit castingError(QString("SOAP action %1 failed: %2").arg(action, reply->errorString()));
             }
             reply->deleteLater();
+
+            if (onFinished)
+                onFinished(ok);
         });
     }
 }
\ No newline at end of file
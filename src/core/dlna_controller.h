@@ -4,6 +4,10 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QHash>
+#include <QStringList>
+#include <functional>
+#include "chunk_cache.h"
 
 namespace CastIt
 {
@@ -16,6 +20,9 @@ namespace CastIt
 		~DlnaController() override;
 
 		void castMedia(const QString& controlUrl, const QString& mediaPath); // Cast to DLNA
+		void castMediaToRenderers(const QStringList& controlUrls, const QString& mediaPath); // Same file to many renderers
+		void stop(const QString& controlUrl); // Stops the renderer and retires its session
+		ChunkCache::Stats cacheStats() const { return ChunkCache::instance().stats(); } // Shared media chunk cache
 
 	signals:
 		void castingStatus(const QString& status);
@@ -23,10 +30,12 @@ namespace CastIt
 
 	private:
 		QNetworkAccessManager* networkManager;
-		QString localMediaUrl;
+		QHash<QString, QString> sessions; // Token published on the shared MediaServer, by renderer control URL
 
-		void startLocalServer(const QString& mediaPath);
-		void sendSoapAction(const QString& controlUrl, const QString& action, const QString& body);
+		QString publishMedia(const QString& mediaPath, bool fanout); // The token, empty on failure
+		void retireSession(const QString& controlUrl); // Unpublishes its token unless another renderer shares it
+		void sendSoapAction(const QString& controlUrl, const QString& action, const QString& body,
+			std::function<void(bool)> onFinished = nullptr); // onFinished receives whether the action succeeded
 
 	};
 
@@ -0,0 +1,143 @@
+#include "dlna_description_cache.h"
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+namespace CastIt
+{
+	DlnaDescriptionCache::DlnaDescriptionCache(QNetworkAccessManager* manager, QObject* parent) : QObject(parent),
+		networkManager(manager)
+	{
+		clock.start();
+	}
+
+	bool DlnaDescriptionCache::request(const QString& key, const QUrl& location, int maxAgeS, qint64 bootId)
+	{
+		const qint64 now = clock.elapsed();
+		const qint64 lifetimeMs = qint64(maxAgeS > 0 ? maxAgeS : DefaultMaxAgeS) * 1000;
+
+		Entry& entry = entries[key];
+		const bool rebooted = bootId >= 0 && entry.bootId >= 0 && bootId != entry.bootId;
+		if (entry.valid && entry.location == location && !rebooted && now < entry.expiresMs)
+		{
+			entry.expiresMs = now + lifetimeMs;
+			if (bootId >= 0)
+				entry.bootId = bootId;
+			return false;
+		}
+		if (entry.valid && rebooted)
+			qDebug() << "Renderer" << key << "rebooted, fetching its description again";
+		if (entry.location != location)
+		{
+			// Moved while its old description was still being fetched: that one no longer counts
+			const auto stale = inFlight.find(entry.location);
+			if (stale != inFlight.end())
+				stale->remove(key);
+		}
+		entry.location = location;
+		entry.bootId = bootId;
+		entry.expiresMs = now + lifetimeMs;
+		entry.valid = false;
+
+		const auto waiting = inFlight.find(location);
+		if (waiting != inFlight.end())
+		{
+			waiting->insert(key);
+			return true;
+		}
+		inFlight.insert(location, { key });
+		if (running < MaxInFlight)
+			start(location);
+		else
+			queued.enqueue(location);
+		prune();
+		return true;
+	}
+
+	void DlnaDescriptionCache::forget(const QString& key)
+	{
+		// A fetch under way for it must not bring it back: it reports to the other keys only
+		const auto entry = entries.constFind(key);
+		if (entry == entries.constEnd())
+			return;
+		const auto waiting = inFlight.find(entry->location);
+		if (waiting != inFlight.end())
+			waiting->remove(key);
+		entries.erase(entry);
+	}
+
+	void DlnaDescriptionCache::setBootId(const QString& key, qint64 bootId)
+	{
+		const auto entry = entries.find(key);
+		if (entry != entries.end())
+			entry->bootId = bootId;
+	}
+
+	void DlnaDescriptionCache::clear()
+	{
+		entries.clear(); // Fetches under way still report, their keys just start out unknown
+	}
+
+	void DlnaDescriptionCache::start(const QUrl& location)
+	{
+		QNetworkRequest request(location);
+		request.setRawHeader("User-Agent", "CastIt/1.0");
+		request.setTransferTimeout(FetchTimeoutMs);
+		QNetworkReply* reply = networkManager->get(request);
+		++running;
+		connect(reply, &QNetworkReply::finished, this, [this, reply]() { onFinished(reply); });
+	}
+
+	void DlnaDescriptionCache::onFinished(QNetworkReply* reply)
+	{
+		--running;
+		reply->deleteLater();
+
+		// Keyed by what was asked for; the reply URL is where redirects ended up, the base for relative URLs
+		const QUrl location = reply->request().url();
+		const QSet<QString> keys = inFlight.take(location);
+		if (reply->error() != QNetworkReply::NoError)
+		{
+			const QString error = reply->errorString();
+			for (const QString& key : keys)
+			{
+				const auto entry = entries.constFind(key);
+				if (entry != entries.constEnd() && entry->location == location)
+					entries.erase(entry);
+				emit failed(key, location, error);
+			}
+		}
+		else
+		{
+			const QByteArray xml = reply->readAll();
+			for (const QString& key : keys)
+			{
+				const auto entry = entries.find(key);
+				if (entry != entries.end() && entry->location == location)
+					entry->valid = true;
+				emit fetched(key, reply->url(), xml);
+			}
+		}
+
+		while (running < MaxInFlight && !queued.isEmpty())
+		{
+			const QUrl next = queued.dequeue();
+			if (inFlight.value(next).isEmpty())
+				inFlight.remove(next); // Everyone who asked for it was forgotten meanwhile
+			else
+				start(next);
+		}
+	}
+
+	void DlnaDescriptionCache::prune()
+	{
+		if (entries.size() <= MaxEntries)
+			return;
+		const qint64 now = clock.elapsed();
+		entries.removeIf([now](const QHash<QString, Entry>::iterator& entry)
+			{
+				return entry->valid && entry->expiresMs <= now;
+			});
+	}
+}
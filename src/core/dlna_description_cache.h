@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+namespace CastIt
+{
+	// Fetches UPnP device descriptions at most once per advertisement lifetime. Each device (by
+	// the uuid of its USN, or its LOCATION) is remembered for its CACHE-CONTROL max-age; repeated
+	// M-SEARCH answers only renew that, until the device reboots (BOOTID) or moves (LOCATION).
+	// Requests for a URL already being fetched join that fetch, and at most MaxInFlight fetches
+	// run at once; the rest wait in line.
+	class DlnaDescriptionCache : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		static constexpr int MaxInFlight = 8;
+		static constexpr int MaxEntries = 512;
+		static constexpr int DefaultMaxAgeS = 1800; // UPnP's recommended minimum, for answers without one
+		static constexpr int FetchTimeoutMs = 3000; // A slow renderer must not hold a slot for long
+
+		explicit DlnaDescriptionCache(QNetworkAccessManager* manager, QObject* parent = nullptr);
+
+		// Emits fetched() or failed() for key later, unless the cached description is still good:
+		// then only its lifetime is renewed and false is returned. maxAgeS and bootId may be -1.
+		bool request(const QString& key, const QUrl& location, int maxAgeS = -1, qint64 bootId = -1);
+		// Next request() fetches again, e.g. after ssdp:byebye; a fetch under way no longer reports for key
+		void forget(const QString& key);
+		void setBootId(const QString& key, qint64 bootId); // Announced by ssdp:update, not a reboot
+		void clear();
+
+	signals:
+		void fetched(const QString& key, const QUrl& location, const QByteArray& xml);
+		void failed(const QString& key, const QUrl& location, const QString& error);
+
+	private:
+		struct Entry
+		{
+			QUrl location;
+			qint64 bootId = -1;
+			qint64 expiresMs = 0; // On clock
+			bool valid = false; // False until the first fetch succeeded
+		};
+
+		QNetworkAccessManager* networkManager;
+		QElapsedTimer clock;
+		QHash<QString, Entry> entries; // By key
+		QHash<QUrl, QSet<QString>> inFlight; // Keys waiting for each URL being fetched or queued
+		QQueue<QUrl> queued; // Beyond MaxInFlight, in request order
+		int running = 0;
+
+		void start(const QUrl& location);
+		void onFinished(QNetworkReply* reply);
+		void prune(); // Drops expired entries once there are too many
+	};
+}
@@ -0,0 +1,161 @@
+#include "dlna_device_description.h"
+#include <QStringList>
+#include <QXmlStreamReader>
+
+namespace CastIt
+{
+	namespace
+	{
+		void readService(QXmlStreamReader& reader, DlnaService& service)
+		{
+			while (reader.readNextStartElement())
+			{
+				const QStringView name = reader.name();
+				if (name == u"serviceType")
+					service.type = reader.readElementText().trimmed();
+				else if (name == u"serviceId")
+					service.id = reader.readElementText().trimmed();
+				else if (name == u"controlURL")
+					service.controlUrl = reader.readElementText().trimmed();
+				else if (name == u"eventSubURL")
+					service.eventUrl = reader.readElementText().trimmed();
+				else if (name == u"SCPDURL")
+					service.scpdUrl = reader.readElementText().trimmed();
+				else
+					reader.skipCurrentElement();
+			}
+		}
+
+		void readDevice(QXmlStreamReader& reader, DlnaDevice& device, int depth)
+		{
+			while (reader.readNextStartElement())
+			{
+				const QStringView name = reader.name();
+				if (name == u"UDN")
+					device.udn = reader.readElementText().trimmed();
+				else if (name == u"deviceType")
+					device.deviceType = reader.readElementText().trimmed();
+				else if (name == u"friendlyName")
+					device.friendlyName = reader.readElementText().trimmed();
+				else if (name == u"manufacturer")
+					device.manufacturer = reader.readElementText().trimmed();
+				else if (name == u"modelName")
+					device.modelName = reader.readElementText().trimmed();
+				else if (name == u"serviceList")
+				{
+					while (reader.readNextStartElement())
+					{
+						if (reader.name() == u"service")
+							readService(reader, device.services.emplaceBack());
+						else
+							reader.skipCurrentElement();
+					}
+				}
+				else if (name == u"deviceList" && depth < DlnaDeviceDescription::MaxDepth)
+				{
+					while (reader.readNextStartElement())
+					{
+						if (reader.name() == u"device")
+							readDevice(reader, device.devices.emplaceBack(), depth + 1);
+						else
+							reader.skipCurrentElement();
+					}
+				}
+				else
+					reader.skipCurrentElement();
+			}
+		}
+
+		void resolveUrls(DlnaDevice& device, const QUrl& base)
+		{
+			const auto resolve = [&base](QString& url)
+				{
+					if (!url.isEmpty())
+						url = base.resolved(QUrl(url)).toString();
+				};
+			for (DlnaService& service : device.services)
+			{
+				resolve(service.controlUrl);
+				resolve(service.eventUrl);
+				resolve(service.scpdUrl);
+			}
+			for (DlnaDevice& embedded : device.devices)
+				resolveUrls(embedded, base);
+		}
+	}
+
+	QString DlnaService::shortName() const
+	{
+		// urn:schemas-upnp-org:service:<name>:<version>
+		const QStringList parts = type.split(':');
+		return parts.size() >= 5 ? parts.at(3) : type;
+	}
+
+	const DlnaService* DlnaDevice::service(const QString& name) const
+	{
+		const QString prefix = "urn:schemas-upnp-org:service:" + name + ':';
+		for (const DlnaService& candidate : services)
+		{
+			if (candidate.type.startsWith(prefix))
+				return &candidate;
+		}
+		return nullptr;
+	}
+
+	const DlnaDevice* DlnaDevice::findWithService(const QString& name) const
+	{
+		if (service(name))
+			return this;
+		for (const DlnaDevice& embedded : devices)
+		{
+			if (const DlnaDevice* found = embedded.findWithService(name))
+				return found;
+		}
+		return nullptr;
+	}
+
+	bool DlnaDeviceDescription::parse(const QByteArray& xml, const QUrl& location)
+	{
+		rootDevice = DlnaDevice();
+		base = location;
+		error.clear();
+
+		// Children of <root> we use: <URLBase> (UPnP 1.0, may come after <device>) and <device>
+		QXmlStreamReader reader(xml);
+		if (!reader.readNextStartElement() || reader.name() != u"root")
+		{
+			error = reader.hasError() ? reader.errorString() : QString("Not a UPnP device description");
+			return false;
+		}
+		bool haveDevice = false;
+		while (reader.readNextStartElement())
+		{
+			if (reader.name() == u"URLBase")
+			{
+				const QUrl urlBase(reader.readElementText().trimmed());
+				if (urlBase.isValid() && !urlBase.isRelative())
+					base = urlBase;
+			}
+			else if (reader.name() == u"device" && !haveDevice)
+			{
+				readDevice(reader, rootDevice, 0);
+				haveDevice = true;
+			}
+			else
+				reader.skipCurrentElement();
+		}
+		if (reader.hasError())
+		{
+			error = reader.errorString();
+			return false;
+		}
+		if (!haveDevice)
+		{
+			error = "Description has no device";
+			return false;
+		}
+
+		resolveUrls(rootDevice, base);
+		return true;
+	}
+}
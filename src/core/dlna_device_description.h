@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+namespace CastIt
+{
+	// One <service> of a UPnP device description, URLs already resolved against the base
+	struct DlnaService
+	{
+		QString type; // e.g. "urn:schemas-upnp-org:service:AVTransport:1"
+		QString id;
+		QString controlUrl;
+		QString eventUrl; // eventSubURL
+		QString scpdUrl;
+
+		QString shortName() const; // "AVTransport"
+	};
+
+	// One <device>, with the devices embedded in it
+	struct DlnaDevice
+	{
+		QString udn;
+		QString deviceType;
+		QString friendlyName;
+		QString manufacturer;
+		QString modelName;
+		QList<DlnaService> services;
+		QList<DlnaDevice> devices;
+
+		// First service whose type starts with "urn:schemas-upnp-org:service:<name>:", any version
+		const DlnaService* service(const QString& name) const;
+		// This device or the first embedded one, depth first, that offers the service
+		const DlnaDevice* findWithService(const QString& name) const;
+	};
+
+	// A UPnP device description read in one streaming pass. Relative URLs are resolved against
+	// <URLBase> if the description has one, else against the URL it was fetched from.
+	class DlnaDeviceDescription
+	{
+	public:
+		static constexpr int MaxDepth = 8; // Of nested deviceLists; deeper ones are skipped
+
+		bool parse(const QByteArray& xml, const QUrl& location);
+		const QString& errorString() const { return error; }
+
+		const DlnaDevice& root() const { return rootDevice; }
+		const QUrl& baseUrl() const { return base; }
+
+	private:
+		DlnaDevice rootDevice;
+		QUrl base;
+		QString error;
+	};
+}
@@ -1,18 +1,39 @@
 #include "dlna_discovery.h"
+#include "device_registry.h"
+#include "dlna_description_cache.h"
+#include "dlna_device_description.h"
+#include "network_interface_monitor.h"
+#include "ssdp_message.h"
 #include <QDebug>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QXmlStreamReader>
 #include <QNetworkInterface>
 #include <QEventLoop>
+#include <limits>
+#include <utility>
 
 
 namespace CastIt
 {
 
 	DlnaDiscovery::DlnaDiscovery(QObject* parent) : QObject(parent), udpSocket(new QUdpSocket(this)),
-		searchTimer(new QTimer(this)), networkManager(new QNetworkAccessManager(this))
+		notifySocket(new QUdpSocket(this)), searchTimer(new QTimer(this)), expiryTimer(new QTimer(this)),
+		networkManager(new QNetworkAccessManager(this)),
+		descriptionCache(new DlnaDescriptionCache(networkManager, this))
 	{
+		clock.start();
+		expiryTimer->setSingleShot(true);
+		connect(expiryTimer, &QTimer::timeout, this, &DlnaDiscovery::expireAdvertisements);
+		connect(descriptionCache, &DlnaDescriptionCache::fetched, this, &DlnaDiscovery::onDescriptionFetched);
+		connect(descriptionCache, &DlnaDescriptionCache::failed, this, &DlnaDiscovery::onDescriptionFailed);
+
+		// Renderers announce themselves (and their departure) to the SSDP group on port 1900; other
+		// UPnP stacks on this host may listen there too
+		if (notifySocket->bind(QHostAddress::AnyIPv4, 1900, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+			connect(notifySocket, &QUdpSocket::readyRead, this, &DlnaDiscovery::processDatagrams);
+		else
+			qWarning() << "Cannot listen for SSDP NOTIFY, searching periodically instead:" << notifySocket->errorString();
 
 		// Try to bind to a random port
 		if (!udpSocket->bind(QHostAddress::AnyIPv4, 0, QUdpSocket::ShareAddress))
@@ -25,8 +46,10 @@ namespace CastIt
 
 		qDebug() << "DLNA discovery bound to port:" << udpSocket->localPort();
 
-		connect(udpSocket, &QUdpSocket::readyRead, this, &DlnaDiscovery::processResponse);
+		connect(udpSocket, &QUdpSocket::readyRead, this, &DlnaDiscovery::processDatagrams);
 		connect(searchTimer, &QTimer::timeout, this, &DlnaDiscovery::sendSearch);
+		connect(NetworkInterfaceMonitor::instance(), &NetworkInterfaceMonitor::interfacesChanged,
+			this, &DlnaDiscovery::onInterfacesChanged);
 	}
 
 	DlnaDiscovery::~DlnaDiscovery()
@@ -37,28 +60,83 @@ namespace CastIt
 	void DlnaDiscovery::startDiscovery()
 	{
 		discoveredRenderers.clear();
-		rendererControlUrls.clear();
 		searchCount = 0;
+		running = true;
+		joinMulticastGroups();
+
+		// Renderers remembered from the last run: fetching their description confirms them
+		// long before an M-SEARCH round would
+		for (const DevicePtr& device : DeviceRegistry::instance()->snapshot())
+		{
+			if (!device->verified && device->kind == DeviceInfo::Kind::Dlna && !device->serviceName.isEmpty())
+				descriptionCache->request(device->id, QUrl(device->serviceName));
+		}
+
+		// A few searches find what is already there; from then on NOTIFYs and max-age expiry keep
+		// the list current without any traffic of ours
 		sendSearch();
-		searchTimer->start(5000); // Send search every 5 seconds
+		searchTimer->start(SearchIntervalMs);
+	}
+
+	void DlnaDiscovery::onInterfacesChanged()
+	{
+		if (!running)
+			return;
+		// A new network: listen there too, and search once more for what is already on it
+		joinMulticastGroups();
+		searchCount = 0;
+		sendSearch();
+		searchTimer->start(SearchIntervalMs);
 	}
 
 	void DlnaDiscovery::joinMulticastGroups()
 	{
-		// Join 239.255.255.250 on all interfaces
-		QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
+		if (notifySocket->state() != QAbstractSocket::BoundState)
+			return;
+
+		// Join 239.255.255.250 on every interface that can carry it, once per interface
+		QSet<int> present;
+		const QList<QNetworkInterface> interfaces = NetworkInterfaceMonitor::instance()->interfaces();
 		for (const QNetworkInterface& interface : interfaces)
 		{
-			if (interface.flags() & QNetworkInterface::CanMulticast)
+			const auto flags = interface.flags();
+			if (!(flags & QNetworkInterface::IsUp) || !(flags & QNetworkInterface::IsRunning) ||
+				!(flags & QNetworkInterface::CanMulticast) || (flags & QNetworkInterface::IsLoopBack))
+				continue;
+			present.insert(interface.index());
+			if (joinedInterfaces.contains(interface.index()))
+				continue;
+			if (notifySocket->joinMulticastGroup(QHostAddress("239.255.255.250"), interface))
 			{
-				udpSocket->joinMulticastGroup(QHostAddress("239.255.255.250"), interface);
+				joinedInterfaces.insert(interface.index());
+				qDebug() << "Listening for SSDP NOTIFY on" << interface.humanReadableName();
 			}
 		}
+		joinedInterfaces.intersect(present); // The kernel dropped memberships of interfaces that went away
 	}
 
 	void DlnaDiscovery::sendSearch()
 	{
 		searchCount++;
+		sendSearchMessage();
+
+		if (searchCount < SearchRounds)
+			return;
+		if (notifySocket->state() == QAbstractSocket::BoundState)
+		{
+			searchTimer->stop();
+			qDebug() << "DLNA discovery search completed";
+		}
+		else if (searchCount == SearchRounds)
+		{
+			// Nobody tells us about renderers that come later (port 1900 taken, e.g. by the
+			// Windows SSDP service), so keep asking, slowly
+			searchTimer->start(FallbackSearchIntervalMs);
+		}
+	}
+
+	void DlnaDiscovery::sendSearchMessage()
+	{
 		QByteArray searchMessage = "M-SEARCH * HTTP/1.1\r\n"
         "HOST: 239.255.255.250:1900\r\n"
         "MAN: \"ssdp:discover\"\r\n"
@@ -67,146 +145,310 @@ namespace CastIt
 		"\r\n";
 		qint64 written = udpSocket->writeDatagram(searchMessage, QHostAddress("239.255.255.250"), 1900);
 		qDebug() << "Sent SSDP M-SEARCH, bytes written: " << written;
-
-		if (searchCount >= 8)
-		{
-			searchTimer->stop();
-			qDebug() << "DLNA discovery search completed";
-		}
 	}
 
-	void DlnaDiscovery::processResponse()
+	void DlnaDiscovery::processDatagrams()
 	{
-		while (udpSocket->hasPendingDatagrams())
+		QUdpSocket* socket = qobject_cast<QUdpSocket*>(sender());
+		if (!socket)
+			return;
+
+		SsdpMessage message;
+		while (socket->hasPendingDatagrams())
 		{
-			QByteArray datagram;
-			datagram.resize(udpSocket->pendingDatagramSize());
+			// The buffer keeps its capacity between datagrams, the parser only takes views into it
+			receiveBuffer.resize(qMax<qint64>(0, socket->pendingDatagramSize()));
 			QHostAddress sender;
-			quint16 port;
-			udpSocket->readDatagram(datagram.data(), datagram.size(), &sender, &port);
+			const qint64 size = socket->readDatagram(receiveBuffer.data(), receiveBuffer.size(), &sender);
+			if (size <= 0)
+				continue;
 
-			QString response = QString::fromUtf8(datagram);
-			if (response.contains("HTTP/1.1 200 OK") &&
-				(response.contains("ST: urn:schemas-upnp-org:device:MediaRenderer:1") ||
-				 response.contains("NT: urn:schemas-upnp-org:device:MediaRenderer:1")))
+			if (!message.parse(QByteArrayView(receiveBuffer.constData(), size)))
 			{
-				// Extract the location URL
-				QString location;
-				QStringList lines = response.split("\r\n");
-				for (const QString& line : lines)
-				{
-					if (line.startsWith("LOCATION:", Qt::CaseInsensitive) ||
-						line.startsWith("Location:", Qt::CaseInsensitive))
-					{
-						location = line.mid(line.indexOf(':') + 1).trimmed();
-						break;
-					}
-				}
-
-				if (!location.isEmpty())
-				{
-					qDebug() << "Found location URL:" << location;
-					parseDeviceDescription(location, sender.toString());
-				}
+				qDebug() << "Dropping SSDP datagram from" << sender.toString() << ":" << message.errorString();
+				continue;
 			}
+			handleMessage(message);
 		}
 	}
 
-	void DlnaDiscovery::parseDeviceDescription(const QString& locationUrl, const QString& ipAddress)
+	void DlnaDiscovery::handleMessage(const SsdpMessage& message)
 	{
-		QNetworkRequest request((QUrl(locationUrl)));
-		request.setRawHeader("User-Agent", "CastIt/1.0");
-		QNetworkReply* reply = networkManager->get(request);
-
-		connect(reply, &QNetworkReply::finished, [this, reply, ipAddress]() {
-			if (reply->error() != QNetworkReply::NoError)
+		const bool renderer = message.target().startsWith(MediaRendererType);
+		switch (message.kind())
+		{
+		case SsdpMessage::Kind::Response:
+			if (message.statusCode() == 200 && renderer)
+				onAdvertisement(message);
+			break;
+		case SsdpMessage::Kind::Notify:
+			switch (message.notification())
 			{
-				qDebug() << "Network error fetching device description:" << reply->errorString();
-				reply->deleteLater();
-				return;
+			case SsdpMessage::Notification::Alive:
+				if (renderer)
+					onAdvertisement(message);
+				break;
+			case SsdpMessage::Notification::ByeBye:
+				// Sent once per device, service and root; any of them for a known uuid will do
+				onByeBye(advertisementKey(message));
+				break;
+			case SsdpMessage::Notification::Update:
+				// Same description, new BOOTID from now on: not a reason to fetch it again
+				if (renderer && message.nextBootId() >= 0)
+					descriptionCache->setBootId(advertisementKey(message), message.nextBootId());
+				break;
+			case SsdpMessage::Notification::None:
+				break;
 			}
+			break;
+		case SsdpMessage::Kind::Search:
+			break; // Another control point searching
+		}
+	}
 
-			QByteArray xml = reply->readAll();
-			qDebug() << "Device description XML:" << xml.left(500) << "...";
+	QString DlnaDiscovery::advertisementKey(const SsdpMessage& message)
+	{
+		return message.usn().isEmpty() ? QString::fromUtf8(message.location()) : QString::fromUtf8(message.deviceUuid());
+	}
 
-			QString deviceName = extractDeviceName(xml);
-			QString controlUrl = extractControlUrl(xml, reply->url().toString());
+	void DlnaDiscovery::onAdvertisement(const SsdpMessage& message)
+	{
+		if (message.location().isEmpty())
+			return;
 
-			if (!controlUrl.isEmpty() && !deviceName.isEmpty())
-			{
-				if (!discoveredRenderers.contains(deviceName))
-				{
-					discoveredRenderers.append(deviceName);
-					rendererControlUrls[deviceName] = controlUrl;
-					qDebug() << "Added DLNA renderer:" << deviceName << "Control URL:" << controlUrl;
-					emit renderersUpdated(discoveredRenderers);
-					emit rendererUrlsUpdated(rendererControlUrls);
-				}
-			}
-			reply->deleteLater();
-			});
+		const QString key = advertisementKey(message);
+		const int maxAgeS = message.maxAge() > 0 ? message.maxAge() : DlnaDescriptionCache::DefaultMaxAgeS;
+		Advertisement& advertisement = advertisements[key];
+		advertisement.expiresMs = clock.elapsed() + qint64(maxAgeS) * 1000;
+		advertisement.searched = false;
+		scheduleExpiry();
+
+		// Every renderer answers every search and re-announces itself well within max-age; only new,
+		// moved, rebooted or expired ones cost a description fetch
+		const QUrl location(QString::fromUtf8(message.location()));
+		if (descriptionCache->request(key, location, message.maxAge(), message.bootId()))
+			qDebug() << "Found location URL:" << location.toString();
 	}
-	QString DlnaDiscovery::extractDeviceName(const QByteArray& xml)
+
+	void DlnaDiscovery::onByeBye(const QString& key)
 	{
-		QXmlStreamReader reader(xml);
-		while (!reader.atEnd())
+		const auto advertisement = advertisements.constFind(key);
+		if (advertisement == advertisements.constEnd())
+			return;
+		qDebug() << "DLNA renderer left:" << key;
+		const QString deviceId = advertisement->deviceId;
+		advertisements.erase(advertisement);
+		dropRenderer(key, deviceId);
+		scheduleExpiry();
+	}
+
+	void DlnaDiscovery::expireAdvertisements()
+	{
+		// Gone without a byebye (unplugged, out of range): silent for longer than it promised. NOTIFYs
+		// can be lost or firewalled though, so a renderer is asked once before it is dropped.
+		const qint64 now = clock.elapsed();
+		bool search = false;
+		for (auto it = advertisements.begin(); it != advertisements.end();)
 		{
-			reader.readNext();
-			if (reader.isStartElement())
+			if (!it->searched && it->expiresMs - RefreshMarginMs <= now)
 			{
-				if (reader.name() == "friendlyName")
-				{
-					return reader.readElementText();
-				}
-				else if (reader.name() == "modelName")
-				{
-					QString modelName = reader.readElementText();
-					if (!modelName.isEmpty())
-						return modelName;
-				}
+				it->searched = true;
+				it->expiresMs = qMax(it->expiresMs, now + SearchGraceMs);
+				search = true;
+				++it;
+				continue;
+			}
+			if (it->expiresMs > now)
+			{
+				++it;
+				continue;
 			}
+			qDebug() << "DLNA renderer advertisement expired:" << it.key();
+			const QString key = it.key();
+			const QString deviceId = it->deviceId;
+			it = advertisements.erase(it);
+			dropRenderer(key, deviceId);
 		}
-		return QString();
+		if (search)
+			sendSearchMessage(); // One for all renderers due, their answers renew them
+		scheduleExpiry();
 	}
 
-	
+	void DlnaDiscovery::scheduleExpiry()
+	{
+		qint64 next = -1;
+		for (const Advertisement& advertisement : std::as_const(advertisements))
+		{
+			const qint64 due = advertisement.searched ? advertisement.expiresMs : advertisement.expiresMs - RefreshMarginMs;
+			if (next < 0 || due < next)
+				next = due;
+		}
+		if (next < 0)
+		{
+			expiryTimer->stop();
+			return;
+		}
+		expiryTimer->start(int(qBound<qint64>(0, next - clock.elapsed(), std::numeric_limits<int>::max())));
+	}
 
-	QString DlnaDiscovery::extractControlUrl(const QByteArray& xml, const QString& baseUrl)
+	void DlnaDiscovery::dropRenderer(const QString& key, const QString& deviceId)
 	{
-		QXmlStreamReader reader(xml);
-		QUrl base(baseUrl);
+		descriptionCache->forget(key);
+		if (deviceId.isEmpty())
+			return;
+		// An embedded renderer can be known under the probe's root UDN and its own uuid at once
+		for (const Advertisement& other : std::as_const(advertisements))
+		{
+			if (other.deviceId == deviceId)
+				return;
+		}
+		discoveredRenderers.remove(deviceId);
+		DeviceRegistry::instance()->remove(deviceId);
+	}
 
-		while (!reader.atEnd())
+	void DlnaDiscovery::onDescriptionFetched(const QString& key, const QUrl& location, const QByteArray& xml)
+	{
+		DlnaDeviceDescription description;
+		if (!description.parse(xml, location))
 		{
-			reader.readNext();
-			if (reader.isStartElement() && reader.name() == "service")
-			{
-				QString serviceType;
-				QString controlUrl;
+			qDebug() << "Malformed device description at" << location.toString() << ":" << description.errorString();
+			descriptionCache->forget(key); // Cached, it would only be renewed; the next announcement fetches again
+			return;
+		}
+
+		// The renderer may be the root device or embedded in it (e.g. in a TV or an AV receiver)
+		const DlnaDevice& root = description.root();
+		const DlnaDevice* renderer = root.findWithService("AVTransport");
+		if (!renderer)
+			return;
+
+		DeviceInfo device;
+		device.kind = DeviceInfo::Kind::Dlna;
+		device.serviceName = location.toString();
+		device.id = root.udn.isEmpty() ? key : root.udn;
+		device.name = !renderer->friendlyName.isEmpty() ? renderer->friendlyName :
+			!root.friendlyName.isEmpty() ? root.friendlyName : renderer->modelName;
+		if (device.name.isEmpty())
+			return;
+		device.model = renderer->modelName;
+		device.address = QHostAddress(location.host());
+		device.port = quint16(location.port(80));
+		device.controlUrl = renderer->service("AVTransport")->controlUrl;
+		for (const DlnaService& service : renderer->services)
+			device.capabilities.append(service.shortName());
+
+		// Formats from an earlier GetProtocolInfo (or the last run) until the renderer answers again
+		const DlnaService* connectionManager = renderer->service("ConnectionManager");
+		const QString protocolInfoUrl = connectionManager ? connectionManager->controlUrl : QString();
+		const auto cached = protocolInfo.constFind(protocolInfoUrl);
+		if (cached != protocolInfo.constEnd())
+			device.formats = cached.value();
+		else if (const DevicePtr previous = DeviceRegistry::instance()->device(device.id))
+			device.formats = previous->formats;
 
-				while (!reader.atEnd() && !(reader.isEndElement() && reader.name() == "service"))
+		if (!discoveredRenderers.contains(device.id))
+		{
+			discoveredRenderers.insert(device.id);
+			qDebug() << "Added DLNA renderer:" << device.name << "Control URL:" << device.controlUrl
+				<< "services:" << device.capabilities;
+		}
+		DeviceRegistry::instance()->update(device);
+
+		// From now on its advertisements (or their absence) decide how long it stays
+		Advertisement& advertisement = advertisements[key];
+		advertisement.deviceId = device.id;
+		if (advertisement.expiresMs == 0)
+			advertisement.expiresMs = clock.elapsed() + qint64(DlnaDescriptionCache::DefaultMaxAgeS) * 1000;
+		scheduleExpiry();
+
+		if (!protocolInfoUrl.isEmpty() && cached == protocolInfo.constEnd())
+			requestProtocolInfo(device.id, protocolInfoUrl);
+	}
+
+	void DlnaDiscovery::onDescriptionFailed(const QString& key, const QUrl& location, const QString& error)
+	{
+		qDebug() << "Network error fetching device description" << location.toString() << ":" << error;
+		// A remembered renderer that does not answer is gone, unless discovery heard it meanwhile
+		const DevicePtr probed = DeviceRegistry::instance()->device(key);
+		if (probed && !probed->verified)
+			DeviceRegistry::instance()->remove(key);
+	}
+
+	void DlnaDiscovery::requestProtocolInfo(const QString& deviceId, const QString& controlUrl)
+	{
+		// One call per ConnectionManager, however many descriptions point at it; calls to
+		// different renderers run side by side
+		const auto waiting = protocolInfoWaiting.find(controlUrl);
+		if (waiting != protocolInfoWaiting.end())
+		{
+			waiting->insert(deviceId);
+			return;
+		}
+		protocolInfoWaiting.insert(controlUrl, { deviceId });
+
+		QNetworkRequest request((QUrl(controlUrl)));
+		request.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml; charset=\"utf-8\"");
+		request.setRawHeader("SOAPAction", "\"urn:schemas-upnp-org:service:ConnectionManager:1#GetProtocolInfo\"");
+		request.setRawHeader("User-Agent", "CastIt/1.0");
+		request.setTransferTimeout(DlnaDescriptionCache::FetchTimeoutMs);
+		const QByteArray envelope = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+			"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+			"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+			"<s:Body><u:GetProtocolInfo xmlns:u=\"urn:schemas-upnp-org:service:ConnectionManager:1\"/></s:Body>"
+			"</s:Envelope>";
+
+		QNetworkReply* reply = networkManager->post(request, envelope);
+		connect(reply, &QNetworkReply::finished, this, [this, reply, controlUrl]()
+			{
+				reply->deleteLater();
+				const QSet<QString> deviceIds = protocolInfoWaiting.take(controlUrl);
+				if (reply->error() != QNetworkReply::NoError)
 				{
-					reader.readNext();
-					if (reader.isStartElement())
-					{
-						if (reader.name() == "serviceType")
-						{
-							serviceType = reader.readElementText();
-						}
-						else if (reader.name() == "controlURL")
-						{
-							controlUrl = reader.readElementText();
-						}
-					}
+					// Formats stay unknown, casting is attempted as before
+					qDebug() << "GetProtocolInfo failed for" << controlUrl << ":" << reply->errorString();
+					return;
 				}
 
-				if (serviceType.contains("AVTransport") && !controlUrl.isEmpty())
+				const QStringList formats = sinkFormats(reply->readAll());
+				protocolInfo.insert(controlUrl, formats);
+				qDebug() << "Renderer at" << controlUrl << "accepts" << formats;
+				for (const QString& deviceId : deviceIds)
 				{
-					QUrl fullUrl = base.resolved(QUrl(controlUrl));
-					return fullUrl.toString();
+					const DevicePtr current = DeviceRegistry::instance()->device(deviceId);
+					if (!current || current->formats == formats)
+						continue;
+					DeviceInfo device = *current;
+					device.formats = formats;
+					DeviceRegistry::instance()->update(device);
 				}
+			});
+	}
+
+	QStringList DlnaDiscovery::sinkFormats(const QByteArray& response)
+	{
+		// <Sink> holds protocolInfo entries "<protocol>:<network>:<contentFormat>:<additionalInfo>",
+		// comma separated; the MIME types of those we can serve (HTTP GET) are what matters
+		QXmlStreamReader reader(response);
+		QString sink;
+		while (!reader.atEnd())
+		{
+			if (reader.readNext() == QXmlStreamReader::StartElement && reader.name() == u"Sink")
+			{
+				sink = reader.readElementText();
+				break;
 			}
 		}
-		return QString();
+
+		QStringList formats;
+		for (QStringView entry : QStringView(sink).split(','))
+		{
+			const QList<QStringView> fields = entry.trimmed().split(':');
+			if (fields.size() < 3 || (fields.at(0) != u"http-get" && fields.at(0) != u"*"))
+				continue;
+			const QString format = fields.at(2).toString().toLower();
+			if (!format.isEmpty() && !formats.contains(format))
+				formats.append(format);
+		}
+		return formats;
 	}
 }
@@ -7,12 +7,21 @@
 #include <QDataStream>
 #include <QHostAddress>
 #include <QThread>
-#include <QMap>
+#include <QSet>
+#include <QHash>
+#include <QElapsedTimer>
 #include <QNetworkAccessManager>
+#include <QUrl>
 
 
 namespace CastIt
 {
+	class DlnaDescriptionCache;
+	class SsdpMessage;
+
+	// Finds DLNA media renderers: a few M-SEARCH rounds at startup, then the NOTIFYs renderers
+	// send to 239.255.255.250:1900 when they come, stay or go. A renderer that neither answers
+	// nor re-announces itself within its max-age is dropped.
 	class DlnaDiscovery : public QObject
 	{
 		Q_OBJECT
@@ -25,26 +34,61 @@ namespace CastIt
 
 
 	signals:
-		void renderersUpdated(const QStringList& renderers); // Renderer names
-		void rendererUrlsUpdated(const QMap<QString, QString>& rendererUrls); // Name to control URL
 		void discoveryError(const QString& errorMessage);
 
 	private slots:
 		void sendSearch();
-		void processResponse();
+		void processDatagrams(); // Search responses and NOTIFYs alike
+		void expireAdvertisements();
+		void onInterfacesChanged();
+		void onDescriptionFetched(const QString& key, const QUrl& location, const QByteArray& xml);
+		// key: registry id for renderers remembered from the last run, which a failed fetch removes
+		void onDescriptionFailed(const QString& key, const QUrl& location, const QString& error);
 
 	private:
-		QUdpSocket* udpSocket;
+		// A renderer's advertisement, by the uuid of its USN (or its LOCATION)
+		struct Advertisement
+		{
+			QString deviceId; // Registry id, empty until its description was read
+			qint64 expiresMs = 0; // On clock
+			bool searched = false; // Asked for by an M-SEARCH since it was last heard
+		};
+
+		static constexpr int SearchRounds = 3;
+		static constexpr int SearchIntervalMs = 5000;
+		static constexpr int FallbackSearchIntervalMs = 5 * 60 * 1000; // Without a NOTIFY listener
+		static constexpr int RefreshMarginMs = 30000; // Before expiry, unheard renderers get an M-SEARCH
+		static constexpr int SearchGraceMs = 5000; // For the answers to that (MX is 3 s)
+
+		// Any version of the device type; ST and NT carry it with a ":1", ":2"... suffix
+		static constexpr char MediaRendererType[] = "urn:schemas-upnp-org:device:MediaRenderer:";
+
+		QUdpSocket* udpSocket; // Random port, for our M-SEARCHes and their unicast answers
+		QUdpSocket* notifySocket; // Port 1900, in the SSDP group
+		QSet<int> joinedInterfaces;
+		QByteArray receiveBuffer;
 		QTimer* searchTimer;
-		QStringList discoveredRenderers;
-		QMap<QString, QString> rendererControlUrls;
+		QTimer* expiryTimer; // Fires at the earliest advertisement expiry
+		QElapsedTimer clock;
+		QHash<QString, Advertisement> advertisements;
+		bool running = false;
+		QSet<QString> discoveredRenderers; // Registry ids published by this discovery
 		int searchCount = 0;
 		QNetworkAccessManager* networkManager;
+		DlnaDescriptionCache* descriptionCache;
+		QHash<QString, QStringList> protocolInfo; // Sink MIME types by ConnectionManager control URL
+		QHash<QString, QSet<QString>> protocolInfoWaiting; // Registry ids per GetProtocolInfo under way
 
 		void joinMulticastGroups();
-		void parseDeviceDescription(const QString& locationUrl, const QString& ipAddress);
-		QString extractDeviceName(const QByteArray& xml);
-		QString extractControlUrl(const QByteArray& xml, const QString& baseUrl); // Fetch and parse XML
+		void sendSearchMessage(); // One M-SEARCH, outside the startup rounds
+		void handleMessage(const SsdpMessage& message);
+		void onAdvertisement(const SsdpMessage& message); // Search response or ssdp:alive
+		void onByeBye(const QString& key);
+		void scheduleExpiry();
+		void dropRenderer(const QString& key, const QString& deviceId);
+		static QString advertisementKey(const SsdpMessage& message);
+		void requestProtocolInfo(const QString& deviceId, const QString& controlUrl);
+		static QStringList sinkFormats(const QByteArray& response); // From a GetProtocolInfo response
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "fanout_buffer.h"
+#include "chunk_cache.h"
+#include <QMutexLocker>
+
+namespace CastIt
+{
+	FanoutBuffer::FanoutBuffer(const QString& filePath, int ringChunks)
+		: fileId(ChunkCache::fileId(filePath)), capacity(qMax(2, ringChunks)), source(filePath)
+	{
+		ring.resize(capacity);
+		source.open(QIODevice::ReadOnly);
+	}
+
+	int FanoutBuffer::attachCursor()
+	{
+		QMutexLocker locker(&mutex);
+		const int cursorId = nextCursorId++;
+		cursors.insert(cursorId, -1);
+		return cursorId;
+	}
+
+	void FanoutBuffer::detachCursor(int cursorId)
+	{
+		QMutexLocker locker(&mutex);
+		cursors.remove(cursorId);
+	}
+
+	QByteArray FanoutBuffer::chunk(int cursorId, qint64 chunkIndex, QFile& file)
+	{
+		{
+			QMutexLocker locker(&mutex);
+			cursors.insert(cursorId, chunkIndex);
+
+			// Others wanting the chunk being read block briefly and share the read
+			while (readingChunk == chunkIndex)
+				chunkRead.wait(&mutex);
+
+			if (chunkIndex >= firstChunk && chunkIndex < nextChunk)
+			{
+				++counters.ringHits;
+				return ring[chunkIndex % capacity];
+			}
+
+			// A seek away from a window nobody else is using restarts the window where the reader went
+			if (readingChunk < 0 && chunkIndex != nextChunk && !othersInWindowLocked(cursorId))
+			{
+				for (QByteArray& slot : ring)
+					slot = QByteArray();
+				firstChunk = nextChunk = chunkIndex;
+			}
+
+			if (readingChunk < 0 && chunkIndex == nextChunk && source.isOpen())
+			{
+				// The leading cursor advances the pipeline. The disk read runs outside the lock so
+				// cursors inside the window keep being served from the ring meanwhile.
+				readingChunk = chunkIndex;
+				locker.unlock();
+
+				QByteArray data;
+				if (source.seek(chunkIndex * ChunkCache::ChunkSize))
+					data = source.read(ChunkCache::ChunkSize);
+				ChunkCache::instance().insert(fileId, chunkIndex, data);
+
+				locker.relock();
+				readingChunk = -1;
+				chunkRead.wakeAll();
+				if (data.isEmpty())
+					return data;
+
+				// The oldest chunk drops out rather than waiting for slow cursors
+				ring[chunkIndex % capacity] = data;
+				++nextChunk;
+				if (nextChunk - firstChunk > capacity)
+					++firstChunk;
+				++counters.pipelineReads;
+				return data;
+			}
+			++counters.fallbacks;
+		}
+
+		return ChunkCache::instance().chunk(fileId, file, chunkIndex);
+	}
+
+	FanoutBuffer::Stats FanoutBuffer::stats() const
+	{
+		QMutexLocker locker(&mutex);
+		Stats snapshot = counters;
+		snapshot.cursors = cursors.size();
+		for (qint64 position : cursors)
+		{
+			if (position >= 0 && position < firstChunk)
+				++snapshot.laggingCursors;
+		}
+		return snapshot;
+	}
+
+	bool FanoutBuffer::othersInWindowLocked(int cursorId) const
+	{
+		for (auto it = cursors.constBegin(); it != cursors.constEnd(); ++it)
+		{
+			if (it.key() != cursorId && it.value() >= firstChunk && it.value() <= nextChunk)
+				return true;
+		}
+		return false;
+	}
+}
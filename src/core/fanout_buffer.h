@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+
+namespace CastIt
+{
+	// Single read pipeline for a file cast to many renderers at once. The file is read
+	// sequentially, once, into a ring of chunks; each client keeps its own cursor into it.
+	// The ring never waits for anyone: a cursor that falls behind the oldest chunk, or seeks
+	// away from the window, is served from the shared ChunkCache instead. Pipeline reads go
+	// into that cache as well, so lagging cursors usually still hit memory.
+	class FanoutBuffer
+	{
+	public:
+		struct Stats
+		{
+			quint64 ringHits = 0; // Chunks handed out from the ring
+			quint64 pipelineReads = 0; // Chunks read from disk by the pipeline
+			quint64 fallbacks = 0; // Requests outside the window
+			int cursors = 0;
+			int laggingCursors = 0; // Cursors currently behind the window
+		};
+
+		explicit FanoutBuffer(const QString& filePath, int ringChunks = 32);
+
+		int attachCursor();
+		void detachCursor(int cursorId);
+
+		// Chunk chunkIndex for the given cursor. file is the caller's own handle, used for fallbacks.
+		QByteArray chunk(int cursorId, qint64 chunkIndex, QFile& file);
+
+		Stats stats() const;
+
+	private:
+		const quint64 fileId;
+		const int capacity;
+		mutable QMutex mutex;
+		QWaitCondition chunkRead; // Signalled when the pipeline read in flight finishes
+		QFile source; // Only touched by the cursor holding the in-flight read
+		qint64 readingChunk = -1; // Chunk the pipeline is reading outside the lock, -1 when idle
+		QList<QByteArray> ring; // Chunk n lives in ring[n % capacity]
+		qint64 firstChunk = 0; // Oldest chunk still in the ring
+		qint64 nextChunk = 0; // Next chunk the pipeline reads
+		QHash<int, qint64> cursors; // Cursor id to last requested chunk
+		int nextCursorId = 1;
+		Stats counters;
+
+		bool othersInWindowLocked(int cursorId) const;
+	};
+}
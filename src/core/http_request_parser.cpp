@@ -0,0 +1,249 @@
+#include "http_request_parser.h"
+#include <cstring>
+
+namespace CastIt
+{
+	namespace
+	{
+		bool equalsIgnoreCase(QByteArrayView a, QByteArrayView b)
+		{
+			return a.size() == b.size() && qstrnicmp(a.data(), a.size(), b.data(), b.size()) == 0;
+		}
+
+		// True if the comma-separated list (e.g. a Connection header) holds the token
+		bool containsToken(QByteArrayView list, QByteArrayView token)
+		{
+			qsizetype from = 0;
+			while (from <= list.size())
+			{
+				qsizetype comma = list.indexOf(',', from);
+				if (comma < 0)
+					comma = list.size();
+				if (equalsIgnoreCase(list.sliced(from, comma - from).trimmed(), token))
+					return true;
+				from = comma + 1;
+			}
+			return false;
+		}
+
+		bool isTokenChar(char c)
+		{
+			// RFC 9110 tchar
+			if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+				return true;
+			return c != 0 && std::strchr("!#$%&'*+-.^_`|~", c) != nullptr;
+		}
+	}
+
+	QByteArrayView HttpRequestParser::Request::header(QByteArrayView name) const
+	{
+		for (int i = 0; i < headerCount; ++i)
+		{
+			if (equalsIgnoreCase(headers[i].name, name))
+				return headers[i].value;
+		}
+		return QByteArrayView();
+	}
+
+	void HttpRequestParser::commit(qsizetype bytes)
+	{
+		used += qBound<qsizetype>(0, bytes, writableSpace());
+	}
+
+	qsizetype HttpRequestParser::append(QByteArrayView data)
+	{
+		const qsizetype accepted = qMin(data.size(), writableSpace());
+		std::memcpy(writePointer(), data.data(), accepted);
+		used += accepted;
+		return accepted;
+	}
+
+	HttpRequestParser::Status HttpRequestParser::parse()
+	{
+		if (state == State::Complete)
+			return Status::Complete;
+		if (state == State::Error)
+			return Status::Error;
+
+		if (bodyToDiscard > 0)
+		{
+			// Leftover of a body we don't serve (GET with Content-Length), skip it as it arrives
+			const qsizetype dropped = qsizetype(qMin<qint64>(bodyToDiscard, used));
+			std::memmove(buffer.data(), buffer.data() + dropped, used - dropped);
+			used -= dropped;
+			bodyToDiscard -= dropped;
+			if (bodyToDiscard > 0)
+				return Status::NeedMore;
+		}
+
+		while (scanPos < used)
+		{
+			const void* newline = std::memchr(buffer.data() + scanPos, '\n', used - scanPos);
+			if (!newline)
+			{
+				scanPos = used;
+				break;
+			}
+
+			const qsizetype lineEnd = static_cast<const char*>(newline) - buffer.data();
+			qsizetype length = lineEnd - lineStart;
+			if (length > 0 && buffer[lineEnd - 1] == '\r')
+				--length;
+			const QByteArrayView line(buffer.data() + lineStart, length);
+			scanPos = lineEnd + 1;
+			lineStart = scanPos;
+
+			if (state == State::RequestLine)
+			{
+				// Empty lines before the request line are tolerated (RFC 9112 2.2)
+				if (line.isEmpty())
+					continue;
+				if (!parseRequestLine(line))
+					return Status::Error;
+				state = State::Headers;
+				continue;
+			}
+
+			if (!line.isEmpty())
+			{
+				if (!parseHeaderLine(line))
+					return Status::Error;
+				continue;
+			}
+
+			// Blank line: the head is complete
+			if (current.minorVersion >= 1)
+				current.keepAlive = !containsToken(current.header("Connection"), "close");
+			else
+				current.keepAlive = containsToken(current.header("Connection"), "keep-alive");
+			headEnd = lineStart;
+			state = State::Complete;
+			return Status::Complete;
+		}
+
+		if (used == BufferSize)
+		{
+			reject("Request head too large");
+			return Status::Error;
+		}
+		return Status::NeedMore;
+	}
+
+	void HttpRequestParser::consume()
+	{
+		if (state != State::Complete)
+			return;
+
+		const qsizetype remaining = used - headEnd;
+		std::memmove(buffer.data(), buffer.data() + headEnd, remaining);
+		used = remaining;
+		bodyToDiscard = current.contentLength;
+
+		lineStart = 0;
+		scanPos = 0;
+		headEnd = 0;
+		state = State::RequestLine;
+		current = Request();
+	}
+
+	void HttpRequestParser::reset()
+	{
+		used = 0;
+		lineStart = 0;
+		scanPos = 0;
+		headEnd = 0;
+		bodyToDiscard = 0;
+		state = State::RequestLine;
+		current = Request();
+		error = nullptr;
+	}
+
+	bool HttpRequestParser::parseRequestLine(QByteArrayView line)
+	{
+		// method SP request-target SP HTTP-version
+		const qsizetype firstSpace = line.indexOf(' ');
+		const qsizetype lastSpace = line.lastIndexOf(' ');
+		if (firstSpace <= 0 || lastSpace <= firstSpace + 1)
+			return reject("Malformed request line");
+
+		current.method = line.first(firstSpace);
+		current.target = line.sliced(firstSpace + 1, lastSpace - firstSpace - 1);
+		const QByteArrayView version = line.sliced(lastSpace + 1);
+
+		for (char c : current.method)
+		{
+			if (!isTokenChar(c))
+				return reject("Invalid method");
+		}
+		if (current.target.contains(' '))
+			return reject("Malformed request target");
+		if (version.size() != 8 || !version.startsWith("HTTP/1.") || (version[7] != '0' && version[7] != '1'))
+			return reject("Unsupported HTTP version");
+
+		current.minorVersion = version[7] - '0';
+		return true;
+	}
+
+	bool HttpRequestParser::parseHeaderLine(QByteArrayView line)
+	{
+		if (line.front() == ' ' || line.front() == '\t')
+			return reject("Obsolete header line folding");
+
+		const qsizetype colon = line.indexOf(':');
+		if (colon <= 0)
+			return reject("Malformed header line");
+
+		const QByteArrayView name = line.first(colon);
+		for (char c : name)
+		{
+			// Also rejects whitespace before the colon, a classic request smuggling vector
+			if (!isTokenChar(c))
+				return reject("Invalid header name");
+		}
+		if (current.headerCount == MaxHeaders)
+			return reject("Too many headers");
+
+		const QByteArrayView value = line.sliced(colon + 1).trimmed();
+		current.headers[current.headerCount++] = Header{ name, value };
+
+		if (equalsIgnoreCase(name, "Range"))
+		{
+			current.range = value;
+		}
+		else if (equalsIgnoreCase(name, "TimeSeekRange.dlna.org"))
+		{
+			current.timeSeekRange = value;
+		}
+		else if (equalsIgnoreCase(name, "transferMode.dlna.org"))
+		{
+			current.transferMode = value;
+		}
+		else if (equalsIgnoreCase(name, "getcontentFeatures.dlna.org"))
+		{
+			current.contentFeaturesRequested = value == "1";
+		}
+		else if (equalsIgnoreCase(name, "Content-Length"))
+		{
+			bool ok = !value.isEmpty();
+			for (char c : value)
+				ok = ok && c >= '0' && c <= '9';
+			const qint64 length = ok ? value.toLongLong(&ok) : -1;
+			if (!ok || (current.contentLength > 0 && current.contentLength != length))
+				return reject("Invalid Content-Length");
+			current.contentLength = length;
+		}
+		else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+		{
+			// A media server has no use for chunked request bodies, refuse rather than guess framing
+			return reject("Transfer-Encoding in requests is not supported");
+		}
+		return true;
+	}
+
+	bool HttpRequestParser::reject(const char* reason)
+	{
+		error = reason;
+		state = State::Error;
+		return false;
+	}
+}
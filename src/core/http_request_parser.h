@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QtGlobal>
+#include <array>
+
+namespace CastIt
+{
+	// Incremental HTTP/1.x request-head parser. Bytes are read straight into a fixed buffer and
+	// the line scan resumes where the previous segment ended, so split packets are never rescanned.
+	// Everything in Request is a view into that buffer and stays valid until consume().
+	class HttpRequestParser
+	{
+	public:
+		static constexpr qsizetype BufferSize = 16 * 1024; // Largest request head accepted
+		static constexpr int MaxHeaders = 48;
+
+		enum class Status
+		{
+			NeedMore,
+			Complete,
+			Error // Malformed or oversized head, answer 400 and close
+		};
+
+		struct Header
+		{
+			QByteArrayView name;
+			QByteArrayView value;
+		};
+
+		struct Request
+		{
+			QByteArrayView method;
+			QByteArrayView target;
+			int minorVersion = 1; // HTTP/1.x
+			bool keepAlive = true;
+			qint64 contentLength = 0;
+
+			// Headers the media server acts on, picked out while parsing
+			QByteArrayView range;
+			QByteArrayView timeSeekRange; // TimeSeekRange.dlna.org
+			QByteArrayView transferMode; // transferMode.dlna.org
+			bool contentFeaturesRequested = false; // getcontentFeatures.dlna.org: 1
+
+			std::array<Header, MaxHeaders> headers;
+			int headerCount = 0;
+
+			bool isGet() const { return method == "GET"; }
+			bool isHead() const { return method == "HEAD"; }
+			QByteArrayView header(QByteArrayView name) const; // Case-insensitive, empty if absent
+		};
+
+		// Zero-copy filling: read into writePointer() then commit() what was read
+		char* writePointer() { return buffer.data() + used; }
+		qsizetype writableSpace() const { return BufferSize - used; }
+		void commit(qsizetype bytes);
+		qsizetype append(QByteArrayView data); // Copying convenience, returns the bytes accepted
+
+		Status parse();
+		const Request& request() const { return current; }
+		const char* errorString() const { return error; }
+
+		// Drops the completed request (and any body it announced) and moves pipelined bytes to the front
+		void consume();
+		void reset();
+
+	private:
+		enum class State
+		{
+			RequestLine,
+			Headers,
+			Complete,
+			Error
+		};
+
+		std::array<char, BufferSize> buffer;
+		qsizetype used = 0;
+		qsizetype lineStart = 0; // Start of the line being scanned
+		qsizetype scanPos = 0; // Where the search for the next LF resumes
+		qsizetype headEnd = 0;
+		qint64 bodyToDiscard = 0;
+		State state = State::RequestLine;
+		Request current;
+		const char* error = nullptr;
+
+		bool parseRequestLine(QByteArrayView line);
+		bool parseHeaderLine(QByteArrayView line);
+		bool reject(const char* reason); // Enters the error state, always returns false
+	};
+}
@@ -0,0 +1,229 @@
+#include "mdns_message.h"
+#include <QtEndian>
+#include <cstring>
+
+namespace CastIt
+{
+	namespace
+	{
+		quint16 read16(QByteArrayView packet, qsizetype offset)
+		{
+			return qFromBigEndian<quint16>(packet.data() + offset);
+		}
+
+		quint32 read32(QByteArrayView packet, qsizetype offset)
+		{
+			return qFromBigEndian<quint32>(packet.data() + offset);
+		}
+	}
+
+	bool MdnsMessage::parse(QByteArrayView data)
+	{
+		packet = data;
+		questions = 0;
+		records = 0;
+		truncated = false;
+		error = nullptr;
+
+		if (packet.size() < 12)
+			return reject("Shorter than a DNS header");
+
+		messageId = read16(packet, 0);
+		messageFlags = read16(packet, 2);
+		const int questionTotal = read16(packet, 4);
+		const int sectionCounts[3] = { read16(packet, 6), read16(packet, 8), read16(packet, 10) };
+
+		qsizetype pos = 12;
+		for (int i = 0; i < questionTotal; ++i)
+		{
+			const qsizetype nameOffset = pos;
+			if (!skipName(packet, pos) || pos + 4 > packet.size())
+				return reject("Truncated question");
+
+			if (questions == MaxQuestions)
+			{
+				truncated = true;
+			}
+			else
+			{
+				Question& question = questionTable[questions++];
+				question.nameOffset = nameOffset;
+				question.type = read16(packet, pos);
+				question.qclass = read16(packet, pos + 2) & 0x7FFF;
+				question.unicastResponse = read16(packet, pos + 2) & 0x8000;
+			}
+			pos += 4;
+		}
+
+		for (int section = 0; section < 3; ++section)
+		{
+			for (int i = 0; i < sectionCounts[section]; ++i)
+			{
+				const qsizetype nameOffset = pos;
+				if (!skipName(packet, pos) || pos + 10 > packet.size())
+					return reject("Truncated resource record");
+
+				const quint16 rdataLength = read16(packet, pos + 8);
+				const qsizetype rdataOffset = pos + 10;
+				if (rdataOffset + rdataLength > packet.size())
+					return reject("Record data runs past the packet");
+
+				if (records == MaxRecords)
+				{
+					truncated = true;
+				}
+				else
+				{
+					Record& record = recordTable[records++];
+					record.nameOffset = nameOffset;
+					record.type = read16(packet, pos);
+					record.rclass = read16(packet, pos + 2) & 0x7FFF;
+					record.cacheFlush = read16(packet, pos + 2) & 0x8000;
+					record.ttl = read32(packet, pos + 4);
+					record.rdataOffset = rdataOffset;
+					record.rdataLength = rdataLength;
+					record.section = Section(section);
+				}
+				pos = rdataOffset + rdataLength;
+			}
+		}
+		return true;
+	}
+
+	bool MdnsMessage::readName(qsizetype offset, DnsName& name) const
+	{
+		return readName(packet, offset, name);
+	}
+
+	bool MdnsMessage::readName(QByteArrayView packet, qsizetype& offset, DnsName& name)
+	{
+		name.size = 0;
+		qsizetype pos = offset;
+		qsizetype end = -1; // Where the name as written ends, fixed by the first pointer
+		int hops = 0;
+
+		while (true)
+		{
+			if (pos < 0 || pos >= packet.size())
+				return false;
+
+			const quint8 length = quint8(packet[pos]);
+			if (length == 0)
+			{
+				if (end < 0)
+					end = pos + 1;
+				break;
+			}
+
+			if ((length & 0xC0) == 0xC0)
+			{
+				// Pointers may only refer to earlier data, and the hop limit stops chains that
+				// bounce back and forth between two names
+				if (pos + 1 >= packet.size() || ++hops > MaxPointerHops)
+					return false;
+				const qsizetype target = (qsizetype(length & 0x3F) << 8) | quint8(packet[pos + 1]);
+				if (target >= pos)
+					return false;
+				if (end < 0)
+					end = pos + 2;
+				pos = target;
+				continue;
+			}
+			if (length & 0xC0)
+				return false; // Extended label types (0x40, 0x80) are obsolete
+
+			if (pos + 1 + length > packet.size() || name.size + length + 1 > DnsName::MaxLength)
+				return false;
+			std::memcpy(name.data.data() + name.size, packet.data() + pos + 1, length);
+			name.size += length;
+			name.data[name.size++] = '.';
+			pos += 1 + length;
+		}
+
+		offset = end;
+		return true;
+	}
+
+	bool MdnsMessage::skipName(QByteArrayView packet, qsizetype& offset)
+	{
+		// Only the name as written is walked; where its pointer leads is checked when it is decoded
+		qsizetype pos = offset;
+		while (pos < packet.size())
+		{
+			const quint8 length = quint8(packet[pos]);
+			if (length == 0)
+			{
+				offset = pos + 1;
+				return true;
+			}
+			if ((length & 0xC0) == 0xC0)
+			{
+				if (pos + 2 > packet.size())
+					return false;
+				offset = pos + 2;
+				return true;
+			}
+			if (length & 0xC0)
+				return false;
+			pos += 1 + length;
+		}
+		return false;
+	}
+
+	bool MdnsMessage::ptrTarget(const Record& record, DnsName& target) const
+	{
+		qsizetype offset = record.rdataOffset;
+		return record.type == Dns::PTR && readName(packet, offset, target) &&
+			offset <= record.rdataOffset + record.rdataLength;
+	}
+
+	bool MdnsMessage::srv(const Record& record, Srv& srv) const
+	{
+		if (record.type != Dns::SRV || record.rdataLength < 7)
+			return false;
+
+		srv.priority = read16(packet, record.rdataOffset);
+		srv.weight = read16(packet, record.rdataOffset + 2);
+		srv.port = read16(packet, record.rdataOffset + 4);
+		qsizetype offset = record.rdataOffset + 6;
+		return readName(packet, offset, srv.target) && offset <= record.rdataOffset + record.rdataLength;
+	}
+
+	bool MdnsMessage::ipv4(const Record& record, quint32& address) const
+	{
+		if (record.type != Dns::A || record.rdataLength != 4)
+			return false;
+		address = read32(packet, record.rdataOffset);
+		return true;
+	}
+
+	bool MdnsMessage::ipv6(const Record& record, std::array<quint8, 16>& address) const
+	{
+		if (record.type != Dns::AAAA || record.rdataLength != 16)
+			return false;
+		std::memcpy(address.data(), packet.data() + record.rdataOffset, address.size());
+		return true;
+	}
+
+	bool MdnsMessage::nextTxtEntry(const Record& record, qsizetype& cursor, QByteArrayView& entry) const
+	{
+		if (record.type != Dns::TXT || cursor >= record.rdataLength)
+			return false;
+
+		const qsizetype start = record.rdataOffset + cursor;
+		const quint8 length = quint8(packet[start]);
+		if (cursor + 1 + length > record.rdataLength)
+			return false;
+		entry = packet.sliced(start + 1, length);
+		cursor += 1 + length;
+		return true;
+	}
+
+	bool MdnsMessage::reject(const char* reason)
+	{
+		error = reason;
+		questions = 0;
+		records = 0;
+		return false;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QString>
+#include <QtGlobal>
+#include <array>
+
+namespace CastIt
+{
+	namespace Dns
+	{
+		enum RecordType : quint16
+		{
+			A = 1,
+			PTR = 12,
+			TXT = 16,
+			AAAA = 28,
+			SRV = 33,
+			NSEC = 47,
+			ANY = 255
+		};
+	}
+
+	// A domain name decoded into a fixed buffer, dotted with a trailing dot ("TV._googlecast._tcp.local.").
+	// The root name is empty.
+	struct DnsName
+	{
+		static constexpr int MaxLength = 255; // RFC 1035 limit on the wire; the dotted form is never longer
+
+		std::array<char, MaxLength + 1> data;
+		int size = 0;
+
+		QByteArrayView view() const { return QByteArrayView(data.data(), size); }
+		QString toString() const { return QString::fromUtf8(data.data(), size); }
+	};
+
+	// Bounds-checked view over one mDNS (or plain DNS) message. parse() only validates the layout and
+	// records where everything is; names and record data are decoded on demand into caller-provided
+	// buffers, so parsing never allocates. The packet must outlive the message.
+	class MdnsMessage
+	{
+	public:
+		static constexpr int MaxQuestions = 16;
+		static constexpr int MaxRecords = 64; // Further records are ignored, see isTruncated()
+		static constexpr int MaxPointerHops = 16; // Compression pointers followed per name
+
+		enum class Section : quint8
+		{
+			Answer,
+			Authority,
+			Additional
+		};
+
+		struct Question
+		{
+			qsizetype nameOffset = 0;
+			quint16 type = 0;
+			quint16 qclass = 0;
+			bool unicastResponse = false; // QU bit, the top bit of the class in mDNS
+		};
+
+		struct Record
+		{
+			qsizetype nameOffset = 0;
+			quint16 type = 0;
+			quint16 rclass = 0;
+			bool cacheFlush = false; // Top bit of the class in mDNS
+			quint32 ttl = 0;
+			qsizetype rdataOffset = 0;
+			quint16 rdataLength = 0;
+			Section section = Section::Answer;
+		};
+
+		struct Srv
+		{
+			quint16 priority = 0;
+			quint16 weight = 0;
+			quint16 port = 0;
+			DnsName target;
+		};
+
+		// False for malformed packets; nothing of a rejected packet may be used
+		bool parse(QByteArrayView packet);
+		const char* errorString() const { return error; }
+
+		quint16 id() const { return messageId; }
+		quint16 flags() const { return messageFlags; }
+		bool isResponse() const { return messageFlags & 0x8000; }
+		bool isTruncated() const { return truncated; }
+
+		int questionCount() const { return questions; }
+		const Question& question(int index) const { return questionTable[index]; }
+		int recordCount() const { return records; } // Answers, then authority, then additional records
+		const Record& record(int index) const { return recordTable[index]; }
+
+		bool readName(qsizetype offset, DnsName& name) const;
+		QByteArrayView rdata(const Record& record) const { return packet.sliced(record.rdataOffset, record.rdataLength); }
+		bool ptrTarget(const Record& record, DnsName& target) const;
+		bool srv(const Record& record, Srv& srv) const;
+		bool ipv4(const Record& record, quint32& address) const; // Host byte order
+		bool ipv6(const Record& record, std::array<quint8, 16>& address) const;
+		// Walks the strings of a TXT record; cursor starts at 0
+		bool nextTxtEntry(const Record& record, qsizetype& cursor, QByteArrayView& entry) const;
+
+		// Decodes the name at offset and moves offset past the name as written (not past pointer targets)
+		static bool readName(QByteArrayView packet, qsizetype& offset, DnsName& name);
+
+	private:
+		QByteArrayView packet;
+		quint16 messageId = 0;
+		quint16 messageFlags = 0;
+		int questions = 0;
+		int records = 0;
+		bool truncated = false;
+		const char* error = nullptr;
+		std::array<Question, MaxQuestions> questionTable;
+		std::array<Record, MaxRecords> recordTable;
+
+		static bool skipName(QByteArrayView packet, qsizetype& offset);
+		bool reject(const char* reason); // Always returns false
+	};
+}
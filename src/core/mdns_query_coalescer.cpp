@@ -0,0 +1,162 @@
+#include "mdns_query_coalescer.h"
+#include <QtEndian>
+#include <iterator>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr int HeaderSize = 12;
+		constexpr int MaxPointerOffset = 0x3FFF;
+
+		void append16(QByteArray& data, quint16 value)
+		{
+			data.append(char(value >> 8)).append(char(value & 0xFF));
+		}
+
+		void append32(QByteArray& data, quint32 value)
+		{
+			append16(data, quint16(value >> 16));
+			append16(data, quint16(value & 0xFFFF));
+		}
+	}
+
+	void MdnsQueryCoalescer::writeName(Packet& packet, QByteArrayView dottedName)
+	{
+		qsizetype start = 0;
+		while (start < dottedName.size())
+		{
+			const QByteArray suffix = dottedName.sliced(start).toByteArray().toLower();
+			const auto known = packet.names.constFind(suffix);
+			if (known != packet.names.constEnd())
+			{
+				append16(packet.data, quint16(0xC000 | known.value()));
+				return;
+			}
+			if (packet.data.size() <= MaxPointerOffset)
+				packet.names.insert(suffix, quint16(packet.data.size()));
+
+			qsizetype dot = dottedName.indexOf('.', start);
+			if (dot < 0)
+				dot = dottedName.size();
+			const qsizetype length = qMin<qsizetype>(dot - start, 63);
+			if (length > 0)
+			{
+				packet.data.append(char(length));
+				packet.data.append(dottedName.sliced(start, length));
+			}
+			start = dot + 1;
+		}
+		packet.data.append('\0');
+	}
+
+	bool MdnsQueryCoalescer::appendQuestion(Packet& packet, const Question& question)
+	{
+		const qsizetype rollbackSize = packet.data.size();
+		const QHash<QByteArray, quint16> rollbackNames = packet.names;
+
+		writeName(packet, question.name);
+		append16(packet.data, question.type);
+		append16(packet.data, 1); // IN, multicast response wanted
+		if (packet.data.size() > MaxPacketSize)
+		{
+			packet.data.truncate(rollbackSize);
+			packet.names = rollbackNames;
+			return false;
+		}
+		++packet.questions;
+		return true;
+	}
+
+	bool MdnsQueryCoalescer::appendAnswer(Packet& packet, const MdnsRecordCache::Record& record, qint64 nowMs)
+	{
+		const qsizetype rollbackSize = packet.data.size();
+		const QHash<QByteArray, quint16> rollbackNames = packet.names;
+
+		writeName(packet, record.name);
+		append16(packet.data, record.type);
+		append16(packet.data, 1); // IN, never cache-flush in a known answer
+		append32(packet.data, record.remainingTtl(nowMs));
+		const qsizetype lengthOffset = packet.data.size();
+		append16(packet.data, 0);
+
+		// PTR and SRV targets compress too (RFC 6762 18.14), everything else goes as cached
+		if (record.type == Dns::PTR)
+		{
+			writeName(packet, record.target);
+		}
+		else if (record.type == Dns::SRV)
+		{
+			packet.data.append(record.rdata.first(6));
+			writeName(packet, record.target);
+		}
+		else
+		{
+			packet.data.append(record.rdata);
+		}
+
+		const qsizetype rdataLength = packet.data.size() - lengthOffset - 2;
+		if (packet.data.size() > MaxPacketSize || rdataLength > 0xFFFF)
+		{
+			packet.data.truncate(rollbackSize);
+			packet.names = rollbackNames;
+			return false;
+		}
+		qToBigEndian<quint16>(quint16(rdataLength), packet.data.data() + lengthOffset);
+		++packet.answers;
+		return true;
+	}
+
+	QByteArray MdnsQueryCoalescer::finish(Packet& packet)
+	{
+		char* header = packet.data.data();
+		qToBigEndian<quint16>(packet.questions, header + 4);
+		qToBigEndian<quint16>(packet.answers, header + 6);
+		return packet.data;
+	}
+
+	QList<QByteArray> MdnsQueryCoalescer::build(const QList<Question>& questions, const MdnsRecordCache& cache, qint64 nowMs)
+	{
+		for (auto it = sentAt.begin(); it != sentAt.end();)
+			it = nowMs - it.value() >= InFlightWindowMs ? sentAt.erase(it) : std::next(it);
+
+		QList<Question> pending;
+		for (const Question& question : questions)
+		{
+			const QPair<QByteArray, quint16> key(question.name.toLower(), question.type);
+			if (sentAt.contains(key))
+				continue;
+			sentAt.insert(key, nowMs);
+			pending.append(question);
+		}
+
+		QList<QByteArray> packets;
+		qsizetype next = 0;
+		while (next < pending.size())
+		{
+			Packet packet;
+			packet.data = QByteArray(HeaderSize, '\0'); // ID 0, standard query
+
+			const qsizetype first = next;
+			while (next < pending.size() && appendQuestion(packet, pending[next]))
+				++next;
+			if (next == first)
+			{
+				++next; // A single question that cannot fit is not a valid name anyway
+				continue;
+			}
+
+			// Known answers only while room is left; responders simply repeat the ones we drop
+			for (qsizetype i = first; i < next; ++i)
+			{
+				QByteArray lookupName = pending[i].name;
+				if (!lookupName.endsWith('.'))
+					lookupName.append('.');
+				for (const MdnsRecordCache::Record& record : cache.knownAnswers(lookupName, pending[i].type, nowMs))
+					appendAnswer(packet, record, nowMs);
+			}
+			packets.append(finish(packet));
+		}
+		return packets;
+	}
+}
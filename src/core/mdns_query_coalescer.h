@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include "mdns_record_cache.h"
+
+namespace CastIt
+{
+	// Turns a batch of questions into as few query packets as fit in one Ethernet frame each.
+	// Names are compressed against everything already in the packet, each packet lists the
+	// cached known answers of its questions (RFC 6762 7.1) while room is left, and a question
+	// that went out less than InFlightWindowMs ago is dropped, since its answers are already
+	// on their way.
+	class MdnsQueryCoalescer
+	{
+	public:
+		static constexpr int MaxPacketSize = 1452; // 1500-byte MTU minus IPv6 and UDP headers, so it fits either family
+		// Covers the 20-120 ms responders wait before answering, well below the scheduler's first
+		// one-second repeat, which a timer firing a little early must not see swallowed
+		static constexpr int InFlightWindowMs = 250;
+
+		using Question = MdnsRecordCache::Question;
+
+		QList<QByteArray> build(const QList<Question>& questions, const MdnsRecordCache& cache, qint64 nowMs);
+		void clear() { sentAt.clear(); }
+
+	private:
+		struct Packet
+		{
+			QByteArray data;
+			QHash<QByteArray, quint16> names; // Lowercased dotted suffix -> offset, for compression
+			quint16 questions = 0;
+			quint16 answers = 0;
+		};
+
+		QHash<QPair<QByteArray, quint16>, qint64> sentAt;
+
+		static void writeName(Packet& packet, QByteArrayView dottedName);
+		static bool appendQuestion(Packet& packet, const Question& question);
+		static bool appendAnswer(Packet& packet, const MdnsRecordCache::Record& record, qint64 nowMs);
+		static QByteArray finish(Packet& packet);
+	};
+}
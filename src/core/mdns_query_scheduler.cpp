@@ -0,0 +1,137 @@
+#include "mdns_query_scheduler.h"
+#include <QRandomGenerator>
+#include <limits>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr int CoalesceWindowMs = 20; // Queries due this soon after the first go in the same batch
+	}
+
+	MdnsQueryScheduler::MdnsQueryScheduler(QObject* parent)
+		: QObject(parent),
+		timer(new QTimer(this))
+	{
+		clock.start();
+		timer->setSingleShot(true);
+		connect(timer, &QTimer::timeout, this, &MdnsQueryScheduler::dispatch);
+	}
+
+	void MdnsQueryScheduler::setIdleInterval(int ms)
+	{
+		idleIntervalMs = qMax(ms, InitialIntervalMs);
+	}
+
+	int MdnsQueryScheduler::jitterMs(int lowMs, int highMs)
+	{
+		return int(QRandomGenerator::global()->bounded(lowMs, highMs + 1));
+	}
+
+	QMultiMap<qint64, MdnsQueryScheduler::Entry>::iterator MdnsQueryScheduler::find(const QByteArray& name, quint16 type)
+	{
+		for (auto it = queue.begin(); it != queue.end(); ++it)
+		{
+			if (it->question.type == type && it->question.name.compare(name, Qt::CaseInsensitive) == 0)
+				return it;
+		}
+		return queue.end();
+	}
+
+	void MdnsQueryScheduler::enqueue(qint64 dueMs, const Entry& entry)
+	{
+		queue.insert(dueMs, entry);
+		rearm();
+	}
+
+	void MdnsQueryScheduler::addContinuous(const QByteArray& name, quint16 type)
+	{
+		auto existing = find(name, type);
+		if (existing != queue.end())
+		{
+			if (existing->intervalMs > 0)
+				return;
+			queue.erase(existing); // A pending one-shot becomes the first send of the series
+		}
+		enqueue(clock.elapsed() + jitterMs(20, 120), Entry{ Question{ name, type }, InitialIntervalMs });
+	}
+
+	void MdnsQueryScheduler::queryOnce(const QByteArray& name, quint16 type, int delayMs)
+	{
+		const qint64 due = clock.elapsed() + delayMs + jitterMs(20, 120);
+		auto existing = find(name, type);
+		if (existing != queue.end())
+		{
+			if (existing.key() <= due)
+				return;
+			// Pull the question forward, a continuous query keeps its back-off step
+			const Entry entry = existing.value();
+			queue.erase(existing);
+			enqueue(due, entry);
+			return;
+		}
+		enqueue(due, Entry{ Question{ name, type }, 0 });
+	}
+
+	void MdnsQueryScheduler::reset()
+	{
+		const qint64 now = clock.elapsed();
+		QMultiMap<qint64, Entry> restarted;
+		for (auto it = queue.cbegin(); it != queue.cend(); ++it)
+		{
+			Entry entry = it.value();
+			if (entry.intervalMs > 0)
+			{
+				entry.intervalMs = InitialIntervalMs;
+				restarted.insert(now + jitterMs(20, 120), entry);
+			}
+			else
+			{
+				restarted.insert(it.key(), entry);
+			}
+		}
+		queue = restarted;
+		rearm();
+	}
+
+	void MdnsQueryScheduler::clear()
+	{
+		queue.clear();
+		timer->stop();
+	}
+
+	void MdnsQueryScheduler::dispatch()
+	{
+		const qint64 now = clock.elapsed();
+		QList<Question> due;
+		QList<QPair<qint64, Entry>> repeats;
+		while (!queue.isEmpty() && queue.firstKey() <= now + CoalesceWindowMs)
+		{
+			const Entry entry = queue.take(queue.firstKey());
+			due.append(entry.question);
+			if (entry.intervalMs > 0)
+			{
+				// Up to 2% of jitter keeps the repeats of different hosts from lining up
+				const int interval = entry.intervalMs + jitterMs(0, entry.intervalMs / 50);
+				repeats.append({ now + interval, Entry{ entry.question, qMin(entry.intervalMs * 2, idleIntervalMs) } });
+			}
+		}
+		for (const auto& repeat : repeats)
+			queue.insert(repeat.first, repeat.second);
+		rearm();
+
+		if (!due.isEmpty())
+			emit queriesDue(due);
+	}
+
+	void MdnsQueryScheduler::rearm()
+	{
+		if (queue.isEmpty())
+		{
+			timer->stop();
+			return;
+		}
+		const qint64 delay = qBound<qint64>(0, queue.firstKey() - clock.elapsed(), std::numeric_limits<int>::max());
+		timer->start(int(delay));
+	}
+}
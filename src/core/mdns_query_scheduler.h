@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMultiMap>
+#include <QTimer>
+#include "mdns_record_cache.h"
+
+namespace CastIt
+{
+	// Decides when mDNS questions go out, using one timer over a queue ordered by due time.
+	// Continuous queries follow RFC 6762 5.2: a first send after 20-120 ms, then intervals that
+	// double from one second up to the idle interval. One-shot queries (follow-ups and cache
+	// refreshes) ride along with whatever else is due. Every send gets a little jitter so that
+	// queries due at nearly the same moment leave together and hosts don't synchronise.
+	class MdnsQueryScheduler : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		using Question = MdnsRecordCache::Question;
+
+		static constexpr int InitialIntervalMs = 1000;
+		static constexpr int DefaultIdleIntervalMs = 60 * 1000;
+
+		explicit MdnsQueryScheduler(QObject* parent = nullptr);
+
+		void setIdleInterval(int ms); // Ceiling of the back-off
+		int idleInterval() const { return idleIntervalMs; }
+
+		// Asks continuously for name/type, with back-off. Scheduling it again is a no-op.
+		void addContinuous(const QByteArray& name, quint16 type);
+		// Asks once after roughly delayMs; an already queued question keeps its earlier time
+		void queryOnce(const QByteArray& name, quint16 type, int delayMs = 0);
+		// Network changed: every continuous query starts its burst over
+		void reset();
+		void clear();
+
+		int pendingCount() const { return queue.size(); }
+
+	signals:
+		// Everything due at once, so the caller can pack it into as few packets as possible
+		void queriesDue(const QList<CastIt::MdnsRecordCache::Question>& questions);
+
+	private slots:
+		void dispatch();
+
+	private:
+		struct Entry
+		{
+			Question question;
+			int intervalMs = 0; // Next back-off step of a continuous query, 0 for one-shots
+		};
+
+		QMultiMap<qint64, Entry> queue; // Keyed by due time on clock
+		QElapsedTimer clock;
+		QTimer* timer;
+		int idleIntervalMs = DefaultIdleIntervalMs;
+
+		static int jitterMs(int lowMs, int highMs);
+		QMultiMap<qint64, Entry>::iterator find(const QByteArray& name, quint16 type);
+		void enqueue(qint64 dueMs, const Entry& entry);
+		void rearm();
+	};
+}
@@ -0,0 +1,224 @@
+#include "mdns_record_cache.h"
+#include <QRandomGenerator>
+#include <algorithm>
+#include <iterator>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr qint64 GoodbyeGraceMs = 1000; // RFC 6762 10.1: a TTL of 0 means "gone in one second"
+		constexpr int RefreshCount = 4;
+	}
+
+	MdnsRecordCache::Key MdnsRecordCache::keyFor(QByteArrayView name, quint16 type)
+	{
+		return Key{ name.toByteArray().toLower(), type };
+	}
+
+	qint64 MdnsRecordCache::refreshDueMs(const Record& record)
+	{
+		if (record.refreshesSent >= RefreshCount || record.ttl == 0)
+			return -1;
+		const int permille = 800 + 50 * record.refreshesSent + record.jitterPermille;
+		return record.receivedMs + qint64(record.ttl) * permille;
+	}
+
+	QByteArray MdnsRecordCache::encodeName(QByteArrayView dottedName)
+	{
+		QByteArray wire;
+		wire.reserve(dottedName.size() + 2);
+		qsizetype start = 0;
+		while (start < dottedName.size())
+		{
+			qsizetype dot = dottedName.indexOf('.', start);
+			if (dot < 0)
+				dot = dottedName.size();
+			const qsizetype length = qMin<qsizetype>(dot - start, 63);
+			if (length > 0)
+			{
+				wire.append(char(length));
+				wire.append(dottedName.sliced(start, length));
+			}
+			start = dot + 1;
+		}
+		wire.append('\0');
+		return wire;
+	}
+
+	bool MdnsRecordCache::canonicalRdata(const MdnsMessage& message, const MdnsMessage::Record& source, Record& record)
+	{
+		// Names inside rdata may be compressed against the packet they came in, expand them
+		DnsName target;
+		if (source.type == Dns::PTR)
+		{
+			if (!message.ptrTarget(source, target))
+				return false;
+			record.target = target.view().toByteArray();
+			record.rdata = encodeName(target.view());
+			return true;
+		}
+		if (source.type == Dns::SRV)
+		{
+			MdnsMessage::Srv srv;
+			if (!message.srv(source, srv))
+				return false;
+			record.target = srv.target.view().toByteArray();
+			record.rdata = message.rdata(source).first(6).toByteArray() + encodeName(srv.target.view());
+			return true;
+		}
+		if (source.type == Dns::NSEC)
+			return false; // Only meaningful to the responder that owns the name
+		record.rdata = message.rdata(source).toByteArray();
+		return true;
+	}
+
+	QList<MdnsRecordCache::Change> MdnsRecordCache::ingest(const MdnsMessage& message, qint64 nowMs)
+	{
+		QList<Change> changes;
+		DnsName name;
+		for (int i = 0; i < message.recordCount(); ++i)
+		{
+			const MdnsMessage::Record& source = message.record(i);
+			if (source.section == MdnsMessage::Section::Authority || !message.readName(source.nameOffset, name))
+				continue;
+
+			Record incoming;
+			incoming.name = name.view().toByteArray();
+			incoming.type = source.type;
+			incoming.ttl = source.ttl;
+			incoming.receivedMs = nowMs;
+			incoming.expiresMs = nowMs + qint64(source.ttl) * 1000;
+			incoming.jitterPermille = int(QRandomGenerator::global()->bounded(21));
+			if (!canonicalRdata(message, source, incoming))
+				continue;
+
+			QList<Record>& set = sets[keyFor(incoming.name, incoming.type)];
+
+			// Cache-flush: this announcement replaces the whole set, older members get the grace second
+			if (source.cacheFlush)
+			{
+				for (Record& record : set)
+				{
+					if (record.rdata != incoming.rdata && nowMs - record.receivedMs > GoodbyeGraceMs)
+					{
+						record.expiresMs = qMin(record.expiresMs, nowMs + GoodbyeGraceMs);
+						record.refreshesSent = RefreshCount;
+					}
+				}
+			}
+
+			auto existing = std::find_if(set.begin(), set.end(), [&incoming](const Record& record)
+				{
+					return record.rdata == incoming.rdata;
+				});
+			if (existing != set.end())
+			{
+				if (incoming.ttl == 0)
+				{
+					existing->expiresMs = qMin(existing->expiresMs, nowMs + GoodbyeGraceMs);
+					existing->refreshesSent = RefreshCount; // Nobody should ask for it again
+				}
+				else
+				{
+					*existing = incoming;
+				}
+				continue;
+			}
+
+			if (incoming.ttl == 0 || recordCount >= MaxRecords)
+			{
+				if (set.isEmpty())
+					sets.remove(keyFor(incoming.name, incoming.type));
+				continue;
+			}
+			set.append(incoming);
+			++recordCount;
+			changes.append(Change{ ChangeKind::Added, incoming });
+		}
+		return changes;
+	}
+
+	QList<MdnsRecordCache::Change> MdnsRecordCache::expire(qint64 nowMs)
+	{
+		QList<Change> changes;
+		for (auto it = sets.begin(); it != sets.end();)
+		{
+			QList<Record>& set = it.value();
+			for (qsizetype i = set.size() - 1; i >= 0; --i)
+			{
+				if (set[i].expiresMs <= nowMs)
+				{
+					changes.append(Change{ ChangeKind::Removed, set.takeAt(i) });
+					--recordCount;
+				}
+			}
+			it = set.isEmpty() ? sets.erase(it) : std::next(it);
+		}
+		return changes;
+	}
+
+	QList<MdnsRecordCache::Question> MdnsRecordCache::takeDueRefreshes(qint64 nowMs)
+	{
+		QList<Question> questions;
+		for (auto it = sets.begin(); it != sets.end(); ++it)
+		{
+			bool due = false;
+			for (Record& record : it.value())
+			{
+				const qint64 dueMs = refreshDueMs(record);
+				if (dueMs < 0 || dueMs > nowMs)
+					continue;
+				// Skip the stages already behind us, one question per record is enough
+				while (refreshDueMs(record) >= 0 && refreshDueMs(record) <= nowMs)
+					++record.refreshesSent;
+				due = true;
+			}
+			// One question covers every record of the set
+			if (due)
+				questions.append(Question{ it.value().first().name, it.key().type });
+		}
+		return questions;
+	}
+
+	qint64 MdnsRecordCache::nextDeadline() const
+	{
+		qint64 deadline = -1;
+		for (const QList<Record>& set : sets)
+		{
+			for (const Record& record : set)
+			{
+				const qint64 refresh = refreshDueMs(record);
+				const qint64 next = refresh >= 0 ? qMin(refresh, record.expiresMs) : record.expiresMs;
+				if (deadline < 0 || next < deadline)
+					deadline = next;
+			}
+		}
+		return deadline;
+	}
+
+	QList<MdnsRecordCache::Record> MdnsRecordCache::knownAnswers(QByteArrayView name, quint16 type, qint64 nowMs) const
+	{
+		QList<Record> answers;
+		const auto it = sets.constFind(keyFor(name, type));
+		if (it == sets.constEnd())
+			return answers;
+		for (const Record& record : it.value())
+		{
+			if (record.expiresMs - nowMs > qint64(record.ttl) * 500)
+				answers.append(record);
+		}
+		return answers;
+	}
+
+	QList<MdnsRecordCache::Record> MdnsRecordCache::records(QByteArrayView name, quint16 type) const
+	{
+		return sets.value(keyFor(name, type));
+	}
+
+	void MdnsRecordCache::clear()
+	{
+		sets.clear();
+		recordCount = 0;
+	}
+}
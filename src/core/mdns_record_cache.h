@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHash>
+#include <QList>
+#include "mdns_message.h"
+
+namespace CastIt
+{
+	// RFC 6762 cache of the resource records heard on the link. Records live for their TTL and are
+	// due for refresh queries at 80, 85, 90 and 95% of it (plus up to 2% jitter). Goodbyes (TTL 0)
+	// and cache-flush announcements retire old data one second later, as section 10.1/10.2 asks.
+	// Time is passed in by the caller as milliseconds on any monotonic clock.
+	class MdnsRecordCache
+	{
+	public:
+		static constexpr int MaxRecords = 4096; // New records are ignored beyond this
+
+		struct Record
+		{
+			QByteArray name; // Dotted with a trailing dot, as received
+			quint16 type = 0;
+			QByteArray rdata; // Uncompressed wire form, so it can be compared and sent as a known answer
+			QByteArray target; // Dotted target name of PTR and SRV records
+			quint32 ttl = 0; // Seconds, as announced
+			qint64 receivedMs = 0;
+			qint64 expiresMs = 0;
+			int refreshesSent = 0; // Of the four refresh queries
+			int jitterPermille = 0;
+
+			quint32 remainingTtl(qint64 nowMs) const { return expiresMs > nowMs ? quint32((expiresMs - nowMs) / 1000) : 0; }
+		};
+
+		enum class ChangeKind
+		{
+			Added,
+			Removed // Expired, said goodbye, or flushed by a newer announcement
+		};
+
+		struct Change
+		{
+			ChangeKind kind;
+			Record record;
+		};
+
+		struct Question
+		{
+			QByteArray name;
+			quint16 type = 0;
+		};
+
+		// Caches the answer and additional records of a response. Only additions are reported here,
+		// removals surface from expire() once their grace second is over.
+		QList<Change> ingest(const MdnsMessage& message, qint64 nowMs);
+		QList<Change> expire(qint64 nowMs);
+
+		// Refresh queries due now; each record yields at most one question per call
+		QList<Question> takeDueRefreshes(qint64 nowMs);
+		qint64 nextDeadline() const; // Earliest expiry or refresh, -1 when empty
+
+		// Records worth listing as known answers: more than half of their TTL left (section 7.1)
+		QList<Record> knownAnswers(QByteArrayView name, quint16 type, qint64 nowMs) const;
+		QList<Record> records(QByteArrayView name, quint16 type) const;
+		int size() const { return recordCount; }
+		void clear();
+
+		static QByteArray encodeName(QByteArrayView dottedName); // Uncompressed wire labels
+
+	private:
+		struct Key
+		{
+			QByteArray name; // Lowercased, DNS names compare case-insensitively
+			quint16 type = 0;
+
+			bool operator==(const Key& other) const { return type == other.type && name == other.name; }
+		};
+		friend size_t qHash(const Key& key, size_t seed) { return qHashMulti(seed, key.name, key.type); }
+
+		QHash<Key, QList<Record>> sets;
+		int recordCount = 0;
+
+		static Key keyFor(QByteArrayView name, quint16 type);
+		static qint64 refreshDueMs(const Record& record);
+		static bool canonicalRdata(const MdnsMessage& message, const MdnsMessage::Record& source, Record& record);
+	};
+}
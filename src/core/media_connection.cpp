@@ -0,0 +1,193 @@
+#include "media_connection.h"
+#include "media_server.h"
+#include "media_stream.h"
+#include "media_metrics.h"
+#include <QTcpSocket>
+#include <QTimer>
+#include <QDebug>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr int IdleTimeoutMs = 30000; // Renderers keep connections open between range probes
+
+		// Streaming transfer, byte seeks only, DLNA 1.5
+		const QByteArray DlnaContentFeatures = "DLNA.ORG_OP=01;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=01700000000000000000000000000000";
+	}
+
+	MediaConnection::MediaConnection(QTcpSocket* socket, MediaServer* server, QObject* parent)
+		: QObject(parent), socket(socket), server(server), idleTimer(new QTimer(this))
+	{
+		socket->setParent(this);
+		metrics = MediaMetrics::instance().openConnection(socket->peerAddress().toString());
+		idleTimer->setSingleShot(true);
+		idleTimer->start(IdleTimeoutMs);
+
+		connect(socket, &QTcpSocket::readyRead, this, &MediaConnection::processRequests);
+		connect(socket, &QTcpSocket::disconnected, this, &QObject::deleteLater);
+		connect(idleTimer, &QTimer::timeout, socket, &QTcpSocket::disconnectFromHost);
+	}
+
+	MediaConnection::~MediaConnection()
+	{
+		MediaMetrics::instance().closeConnection(metrics);
+	}
+
+	void MediaConnection::processRequests()
+	{
+		// Pipelined requests are left in the socket until the current body has been queued
+		if (activeStream)
+			return;
+
+		while (!activeStream && socket->state() == QAbstractSocket::ConnectedState)
+		{
+			// Read straight into the parser's buffer, no per-request allocation
+			while (parser.writableSpace() > 0 && socket->bytesAvailable() > 0)
+			{
+				const qint64 read = socket->read(parser.writePointer(), parser.writableSpace());
+				if (read <= 0)
+					break;
+				parser.commit(read);
+			}
+
+			const HttpRequestParser::Status status = parser.parse();
+			if (status == HttpRequestParser::Status::NeedMore)
+			{
+				// A body bigger than the buffer is discarded one buffer at a time; what is already
+				// in the socket raises no further readyRead, so keep reading until it is drained
+				if (socket->bytesAvailable() > 0 && parser.writableSpace() > 0)
+					continue;
+				break;
+			}
+			if (status == HttpRequestParser::Status::Error)
+			{
+				qDebug() << "Rejecting HTTP request:" << parser.errorString();
+				keepAlive = false;
+				reply(errorResponse(400));
+				socket->disconnectFromHost();
+				return;
+			}
+
+			idleTimer->stop();
+			handleRequest(parser.request());
+			parser.consume();
+
+			if (!keepAlive)
+			{
+				if (!activeStream)
+					socket->disconnectFromHost();
+				return;
+			}
+		}
+
+		if (!activeStream)
+			idleTimer->start(IdleTimeoutMs);
+	}
+
+	void MediaConnection::handleRequest(const HttpRequestParser::Request& request)
+	{
+		requestClock.start();
+		keepAlive = request.keepAlive;
+		MediaMetrics::instance().recordRequest(*metrics, !request.range.isEmpty());
+		qDebug() << "HTTP request:" << request.method << request.target << "Range:" << request.range;
+
+		if (!request.isGet() && !request.isHead())
+		{
+			keepAlive = false;
+			reply(errorResponse(405));
+			return;
+		}
+
+		// Scrape endpoint for local monitoring, not served to the LAN
+		if (request.target == "/metrics" && socket->peerAddress().isLoopback())
+		{
+			replyMetrics(request.isHead());
+			return;
+		}
+
+		// Targets look like /media/<token>/<file name>
+		QByteArrayView token;
+		if (request.target.startsWith("/media/"))
+		{
+			token = request.target.sliced(7);
+			for (qsizetype i = 0; i < token.size(); ++i)
+			{
+				if (token[i] == '/' || token[i] == '?')
+				{
+					token = token.first(i);
+					break;
+				}
+			}
+		}
+
+		MediaServer::Publication publication;
+		if (token.isEmpty() || !server->lookup(token, publication))
+		{
+			reply(errorResponse(404));
+			return;
+		}
+
+		// Only byte seeking is advertised (DLNA.ORG_OP=01), time-based seeks are refused
+		if (!request.timeSeekRange.isEmpty())
+		{
+			reply(errorResponse(406));
+			return;
+		}
+
+		MediaResponse response = prepareMediaResponse(publication, request.isHead(), request.range);
+		if (response.statusCode == 200 || response.statusCode == 206)
+		{
+			if (request.contentFeaturesRequested)
+				response.headers.append({ "contentFeatures.dlna.org", DlnaContentFeatures });
+			if (!request.transferMode.isEmpty())
+				response.headers.append({ "transferMode.dlna.org", request.transferMode.toByteArray() });
+		}
+
+		if (!response.body)
+		{
+			reply(response);
+			return;
+		}
+
+		MediaMetrics::instance().recordResponse(*metrics, response.statusCode);
+		pacer.configure(publication.paceBytesPerSecond, publication.burstBytes);
+		activeStream = new MediaStream(socket, response.body, &pacer, metrics, this);
+		connect(activeStream, &MediaStream::finished, this, &MediaConnection::onStreamFinished);
+		activeStream->start(response.headerBlock(keepAlive), requestClock);
+	}
+
+	void MediaConnection::reply(const MediaResponse& response)
+	{
+		MediaMetrics::instance().recordResponse(*metrics, response.statusCode);
+		socket->write(response.headerBlock(keepAlive));
+	}
+
+	void MediaConnection::replyMetrics(bool headOnly)
+	{
+		const QByteArray text = MediaMetrics::instance().prometheusText();
+		MediaResponse response;
+		response.headers = {
+			{ "Content-Type", "text/plain; version=0.0.4; charset=utf-8" },
+			{ "Content-Length", QByteArray::number(text.size()) },
+			{ "Cache-Control", "no-store" }
+		};
+		reply(response);
+		if (!headOnly)
+			socket->write(text);
+	}
+
+	void MediaConnection::onStreamFinished()
+	{
+		activeStream->deleteLater();
+		activeStream = nullptr;
+
+		if (!keepAlive)
+		{
+			socket->disconnectFromHost();
+			return;
+		}
+		// Queued: a short body can finish inside start(), and pipelined requests must not recurse
+		QMetaObject::invokeMethod(this, &MediaConnection::processRequests, Qt::QueuedConnection);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <memory>
+#include "http_request_parser.h"
+#include "token_bucket.h"
+
+class QTcpSocket;
+class QTimer;
+
+namespace CastIt
+{
+	class MediaServer;
+	class MediaStream;
+	struct MediaResponse;
+	struct ConnectionMetrics;
+
+	// One persistent HTTP/1.1 client of the MediaServer. Requests are answered strictly in order;
+	// pipelined requests stay queued in the socket while a body is still being streamed.
+	class MediaConnection : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		MediaConnection(QTcpSocket* socket, MediaServer* server, QObject* parent = nullptr);
+		~MediaConnection() override;
+
+	private slots:
+		void processRequests();
+		void onStreamFinished();
+
+	private:
+		QTcpSocket* socket;
+		MediaServer* server;
+		QTimer* idleTimer;
+		HttpRequestParser parser;
+		TokenBucket pacer; // Kept across keep-alive requests, so range requests can't reset the burst
+		MediaStream* activeStream = nullptr;
+		bool keepAlive = true;
+		std::shared_ptr<ConnectionMetrics> metrics;
+		QElapsedTimer requestClock; // Started when a request has been parsed, for time-to-first-byte
+
+		void handleRequest(const HttpRequestParser::Request& request);
+		void reply(const MediaResponse& response); // Writes a head without a streamed body
+		void replyMetrics(bool headOnly);
+	};
+}
@@ -0,0 +1,266 @@
+#include "media_metrics.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace CastIt
+{
+	namespace
+	{
+		void appendMetric(QByteArray& out, const char* name, const char* type, const char* help)
+		{
+			out += QByteArray("# HELP ") + name + ' ' + help + '\n';
+			out += QByteArray("# TYPE ") + name + ' ' + type + '\n';
+		}
+
+		void appendSample(QByteArray& out, const char* name, double value, const QByteArray& labels = QByteArray())
+		{
+			out += name;
+			if (!labels.isEmpty())
+				out += '{' + labels + '}';
+			out += ' ' + QByteArray::number(value, 'g', 17) + '\n';
+		}
+
+		QByteArray escapeLabel(const QString& value)
+		{
+			QByteArray escaped = value.toUtf8();
+			escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+			return escaped;
+		}
+
+		void appendHistogram(QByteArray& out, const char* name, const char* help, const Histogram& histogram)
+		{
+			appendMetric(out, name, "histogram", help);
+			const QByteArray bucketName = QByteArray(name) + "_bucket";
+			quint64 cumulative = 0;
+			for (int i = 0; i < histogram.bounds().size(); ++i)
+			{
+				cumulative += histogram.bucketCount(i);
+				appendSample(out, bucketName.constData(), double(cumulative),
+					"le=\"" + QByteArray::number(histogram.bounds()[i], 'g', 10) + '"');
+			}
+			cumulative += histogram.bucketCount(histogram.bounds().size());
+			appendSample(out, bucketName.constData(), double(cumulative), "le=\"+Inf\"");
+			appendSample(out, (QByteArray(name) + "_sum").constData(), histogram.sum());
+			appendSample(out, (QByteArray(name) + "_count").constData(), double(histogram.count()));
+		}
+	}
+
+	Histogram::Histogram(const QList<double>& upperBounds)
+		: upperBounds(upperBounds), buckets(new QAtomicInteger<quint64>[upperBounds.size() + 1])
+	{
+	}
+
+	void Histogram::observe(double value)
+	{
+		const auto it = std::lower_bound(upperBounds.cbegin(), upperBounds.cend(), value);
+		buckets[it - upperBounds.cbegin()].fetchAndAddRelaxed(1);
+		total.fetchAndAddRelaxed(1);
+		valueSum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	quint64 Histogram::bucketCount(int bucket) const
+	{
+		return bucket >= 0 && bucket <= upperBounds.size() ? buckets[bucket].loadRelaxed() : 0;
+	}
+
+	double Histogram::quantile(double q) const
+	{
+		const quint64 observations = count();
+		if (observations == 0)
+			return 0.0;
+
+		const double rank = q * double(observations);
+		quint64 cumulative = 0;
+		for (int i = 0; i <= upperBounds.size(); ++i)
+		{
+			const quint64 inBucket = bucketCount(i);
+			if (inBucket > 0 && double(cumulative + inBucket) >= rank)
+			{
+				if (i == upperBounds.size())
+					return upperBounds.isEmpty() ? 0.0 : upperBounds.last(); // Nothing better is known
+				const double lower = i == 0 ? 0.0 : upperBounds[i - 1];
+				const double fraction = (rank - double(cumulative)) / double(inBucket);
+				return lower + (upperBounds[i] - lower) * qBound(0.0, fraction, 1.0);
+			}
+			cumulative += inBucket;
+		}
+		return upperBounds.isEmpty() ? 0.0 : upperBounds.last();
+	}
+
+	MediaMetrics& MediaMetrics::instance()
+	{
+		static MediaMetrics metrics;
+		return metrics;
+	}
+
+	MediaMetrics::MediaMetrics()
+		: timeToFirstByte({ 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0 }),
+		throughput({ 64e3, 256e3, 512e3, 1e6, 2e6, 4e6, 8e6, 16e6, 32e6, 64e6, 128e6 })
+	{
+	}
+
+	std::shared_ptr<ConnectionMetrics> MediaMetrics::openConnection(const QString& peer)
+	{
+		auto connection = std::make_shared<ConnectionMetrics>();
+		connection->peer = peer;
+		connection->openedAtMs = QDateTime::currentMSecsSinceEpoch();
+		connectionsTotal.fetchAndAddRelaxed(1);
+
+		QMutexLocker locker(&connectionsMutex);
+		connection->id = nextConnectionId++;
+		connections.insert(connection->id, connection);
+		return connection;
+	}
+
+	void MediaMetrics::closeConnection(const std::shared_ptr<ConnectionMetrics>& connection)
+	{
+		QMutexLocker locker(&connectionsMutex);
+		connections.remove(connection->id);
+	}
+
+	void MediaMetrics::recordRequest(ConnectionMetrics& connection, bool rangeRequest)
+	{
+		requests.fetchAndAddRelaxed(1);
+		connection.requests.fetchAndAddRelaxed(1);
+		if (rangeRequest)
+		{
+			rangeRequests.fetchAndAddRelaxed(1);
+			connection.rangeRequests.fetchAndAddRelaxed(1);
+		}
+	}
+
+	void MediaMetrics::recordResponse(ConnectionMetrics& connection, int statusCode)
+	{
+		if (statusCode >= 0 && statusCode < int(responses.size()))
+			responses[statusCode].fetchAndAddRelaxed(1);
+		if (statusCode >= 400)
+		{
+			errors.fetchAndAddRelaxed(1);
+			connection.errors.fetchAndAddRelaxed(1);
+		}
+	}
+
+	void MediaMetrics::recordFirstByte(ConnectionMetrics& connection, qint64 elapsedNs)
+	{
+		timeToFirstByte.observe(double(elapsedNs) / 1e9);
+		connection.lastTtfbUs.storeRelaxed(elapsedNs / 1000);
+	}
+
+	void MediaMetrics::recordBytes(ConnectionMetrics& connection, qint64 bytes)
+	{
+		bytesSent.fetchAndAddRelaxed(bytes);
+		connection.bytesSent.fetchAndAddRelaxed(bytes);
+	}
+
+	void MediaMetrics::recordTransfer(ConnectionMetrics& connection, qint64 bytes, qint64 elapsedNs)
+	{
+		// Bodies that fit in the socket buffer say nothing about the link, only time real transfers
+		if (bytes < 256 * 1024 || elapsedNs <= 0)
+			return;
+		const double bytesPerSecond = double(bytes) * 1e9 / double(elapsedNs);
+		throughput.observe(bytesPerSecond);
+		connection.lastThroughput.storeRelaxed(qint64(bytesPerSecond));
+	}
+
+	void MediaMetrics::recordAbort(ConnectionMetrics& connection)
+	{
+		streamAborts.fetchAndAddRelaxed(1);
+		errors.fetchAndAddRelaxed(1);
+		connection.errors.fetchAndAddRelaxed(1);
+	}
+
+	MediaMetrics::Snapshot MediaMetrics::snapshot() const
+	{
+		Snapshot snapshot;
+		snapshot.connectionsTotal = connectionsTotal.loadRelaxed();
+		snapshot.requests = requests.loadRelaxed();
+		snapshot.rangeRequests = rangeRequests.loadRelaxed();
+		snapshot.errors = errors.loadRelaxed();
+		snapshot.streamAborts = streamAborts.loadRelaxed();
+		snapshot.bytesSent = bytesSent.loadRelaxed();
+		snapshot.ttfbP50Ms = timeToFirstByte.quantile(0.5) * 1000.0;
+		snapshot.ttfbP99Ms = timeToFirstByte.quantile(0.99) * 1000.0;
+		snapshot.cache = ChunkCache::instance().stats();
+
+		const qint64 now = QDateTime::currentMSecsSinceEpoch();
+		QMutexLocker locker(&connectionsMutex);
+		snapshot.activeConnections = connections.size();
+		for (const auto& connection : connections)
+		{
+			ConnectionSnapshot entry;
+			entry.id = connection->id;
+			entry.peer = connection->peer;
+			entry.connectedMs = now - connection->openedAtMs;
+			entry.bytesSent = connection->bytesSent.loadRelaxed();
+			entry.requests = connection->requests.loadRelaxed();
+			entry.rangeRequests = connection->rangeRequests.loadRelaxed();
+			entry.errors = connection->errors.loadRelaxed();
+			const qint64 ttfbUs = connection->lastTtfbUs.loadRelaxed();
+			entry.lastTtfbMs = ttfbUs < 0 ? -1.0 : double(ttfbUs) / 1000.0;
+			entry.lastThroughput = connection->lastThroughput.loadRelaxed();
+			snapshot.connections.append(entry);
+		}
+		return snapshot;
+	}
+
+	QByteArray MediaMetrics::prometheusText() const
+	{
+		const Snapshot current = snapshot();
+		QByteArray out;
+		out.reserve(8192);
+
+		appendMetric(out, "castit_media_connections_total", "counter", "Client connections accepted.");
+		appendSample(out, "castit_media_connections_total", double(current.connectionsTotal));
+		appendMetric(out, "castit_media_active_connections", "gauge", "Client connections currently open.");
+		appendSample(out, "castit_media_active_connections", current.activeConnections);
+		appendMetric(out, "castit_media_requests_total", "counter", "HTTP requests parsed.");
+		appendSample(out, "castit_media_requests_total", double(current.requests));
+		appendMetric(out, "castit_media_range_requests_total", "counter", "Requests carrying a Range header.");
+		appendSample(out, "castit_media_range_requests_total", double(current.rangeRequests));
+
+		appendMetric(out, "castit_media_responses_total", "counter", "Responses by status code.");
+		for (int code = 100; code < int(responses.size()); ++code)
+		{
+			const quint64 count = responses[code].loadRelaxed();
+			if (count > 0)
+				appendSample(out, "castit_media_responses_total", double(count), "code=\"" + QByteArray::number(code) + '"');
+		}
+
+		appendMetric(out, "castit_media_errors_total", "counter", "Error responses and aborted streams.");
+		appendSample(out, "castit_media_errors_total", double(current.errors));
+		appendMetric(out, "castit_media_stream_aborts_total", "counter", "Bodies abandoned mid-transfer.");
+		appendSample(out, "castit_media_stream_aborts_total", double(current.streamAborts));
+		appendMetric(out, "castit_media_sent_bytes_total", "counter", "Body bytes handed to client sockets.");
+		appendSample(out, "castit_media_sent_bytes_total", double(current.bytesSent));
+
+		appendHistogram(out, "castit_media_time_to_first_byte_seconds",
+			"Time from a parsed request to its first body byte.", timeToFirstByte);
+		appendHistogram(out, "castit_media_body_throughput_bytes_per_second",
+			"Throughput of completed bodies of 256 KiB or more.", throughput);
+
+		appendMetric(out, "castit_media_cache_hits_total", "counter", "Chunk cache hits.");
+		appendSample(out, "castit_media_cache_hits_total", double(current.cache.hits));
+		appendMetric(out, "castit_media_cache_misses_total", "counter", "Chunk cache misses.");
+		appendSample(out, "castit_media_cache_misses_total", double(current.cache.misses));
+		appendMetric(out, "castit_media_cache_evictions_total", "counter", "Chunk cache evictions.");
+		appendSample(out, "castit_media_cache_evictions_total", double(current.cache.evictions));
+		appendMetric(out, "castit_media_cache_bytes", "gauge", "Bytes held by the chunk cache.");
+		appendSample(out, "castit_media_cache_bytes", double(current.cache.bytesCached));
+
+		appendMetric(out, "castit_media_connection_sent_bytes", "gauge", "Body bytes sent on an open connection.");
+		for (const ConnectionSnapshot& connection : current.connections)
+		{
+			appendSample(out, "castit_media_connection_sent_bytes", double(connection.bytesSent),
+				"id=\"" + QByteArray::number(connection.id) + "\",peer=\"" + escapeLabel(connection.peer) + '"');
+		}
+		appendMetric(out, "castit_media_connection_throughput_bytes_per_second", "gauge",
+			"Throughput of the last completed body on an open connection.");
+		for (const ConnectionSnapshot& connection : current.connections)
+		{
+			appendSample(out, "castit_media_connection_throughput_bytes_per_second", double(connection.lastThroughput),
+				"id=\"" + QByteArray::number(connection.id) + "\",peer=\"" + escapeLabel(connection.peer) + '"');
+		}
+		return out;
+	}
+}
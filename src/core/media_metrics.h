@@ -0,0 +1,120 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <memory>
+#include "chunk_cache.h"
+
+namespace CastIt
+{
+	// Fixed-bucket histogram any I/O thread can record into without taking a lock
+	class Histogram
+	{
+	public:
+		explicit Histogram(const QList<double>& upperBounds);
+
+		void observe(double value);
+
+		const QList<double>& bounds() const { return upperBounds; }
+		quint64 bucketCount(int bucket) const; // Not cumulative; bucket bounds().size() is +Inf
+		quint64 count() const { return total.loadRelaxed(); }
+		double sum() const { return valueSum.load(std::memory_order_relaxed); }
+		double quantile(double q) const; // Interpolated within the bucket, 0 when empty
+
+	private:
+		QList<double> upperBounds;
+		std::unique_ptr<QAtomicInteger<quint64>[]> buckets;
+		QAtomicInteger<quint64> total;
+		std::atomic<double> valueSum{ 0.0 };
+	};
+
+	// Live counters of one client connection, shared between the connection and the registry
+	struct ConnectionMetrics
+	{
+		quint64 id = 0;
+		QString peer;
+		qint64 openedAtMs = 0;
+		QAtomicInteger<qint64> bytesSent;
+		QAtomicInteger<quint64> requests;
+		QAtomicInteger<quint64> rangeRequests;
+		QAtomicInteger<quint64> errors;
+		QAtomicInteger<qint64> lastTtfbUs{ -1 };
+		QAtomicInteger<qint64> lastThroughput; // Bytes per second of the last completed body
+	};
+
+	// Process-wide transfer metrics of the media server: aggregate counters and histograms plus
+	// a registry of open connections, so a slow renderer can be singled out by its address.
+	class MediaMetrics
+	{
+	public:
+		struct ConnectionSnapshot
+		{
+			quint64 id = 0;
+			QString peer;
+			qint64 connectedMs = 0;
+			qint64 bytesSent = 0;
+			quint64 requests = 0;
+			quint64 rangeRequests = 0;
+			quint64 errors = 0;
+			double lastTtfbMs = -1.0;
+			qint64 lastThroughput = 0;
+		};
+
+		struct Snapshot
+		{
+			quint64 connectionsTotal = 0;
+			int activeConnections = 0;
+			quint64 requests = 0;
+			quint64 rangeRequests = 0;
+			quint64 errors = 0; // 4xx/5xx responses and aborted streams
+			quint64 streamAborts = 0;
+			qint64 bytesSent = 0;
+			double throughput = 0.0; // Aggregate bytes per second, filled in by MediaServer
+			double ttfbP50Ms = 0.0;
+			double ttfbP99Ms = 0.0;
+			ChunkCache::Stats cache;
+			QList<ConnectionSnapshot> connections;
+		};
+
+		static MediaMetrics& instance();
+
+		std::shared_ptr<ConnectionMetrics> openConnection(const QString& peer);
+		void closeConnection(const std::shared_ptr<ConnectionMetrics>& connection);
+
+		void recordRequest(ConnectionMetrics& connection, bool rangeRequest);
+		void recordResponse(ConnectionMetrics& connection, int statusCode);
+		void recordFirstByte(ConnectionMetrics& connection, qint64 elapsedNs); // Since the request was parsed
+		void recordBytes(ConnectionMetrics& connection, qint64 bytes);
+		void recordTransfer(ConnectionMetrics& connection, qint64 bytes, qint64 elapsedNs); // A completed body
+		void recordAbort(ConnectionMetrics& connection);
+
+		Snapshot snapshot() const;
+		QByteArray prometheusText() const; // Text exposition format 0.0.4
+
+	private:
+		MediaMetrics();
+
+		QAtomicInteger<quint64> connectionsTotal;
+		QAtomicInteger<quint64> requests;
+		QAtomicInteger<quint64> rangeRequests;
+		QAtomicInteger<quint64> errors;
+		QAtomicInteger<quint64> streamAborts;
+		QAtomicInteger<qint64> bytesSent;
+		std::array<QAtomicInteger<quint64>, 600> responses; // By status code
+		Histogram timeToFirstByte; // Seconds
+		Histogram throughput; // Bytes per second, per completed body
+
+		mutable QMutex connectionsMutex;
+		QHash<quint64, std::shared_ptr<ConnectionMetrics>> connections;
+		quint64 nextConnectionId = 1;
+	};
+}
+
+Q_DECLARE_METATYPE(CastIt::MediaMetrics::Snapshot)
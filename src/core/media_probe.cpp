@@ -0,0 +1,785 @@
+#include "media_probe.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include <QTimer>
+#include <QList>
+#include <QPair>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr qint64 HeadSize = 64 * 1024;
+		constexpr int MaxIndexEntries = 20000;
+		constexpr int IndexVersion = 1;
+
+		constexpr quint32 fourCC(const char (&code)[5])
+		{
+			return (quint32(quint8(code[0])) << 24) | (quint32(quint8(code[1])) << 16) |
+				(quint32(quint8(code[2])) << 8) | quint32(quint8(code[3]));
+		}
+
+		quint32 be32(const uchar* p) { return qFromBigEndian<quint32>(p); }
+		quint64 be64(const uchar* p) { return qFromBigEndian<quint64>(p); }
+		quint32 le32(const uchar* p) { return qFromLittleEndian<quint32>(p); }
+		quint16 le16(const uchar* p) { return qFromLittleEndian<quint16>(p); }
+
+		QString fourCCString(quint32 code)
+		{
+			const char text[4] = { char(code >> 24), char(code >> 16), char(code >> 8), char(code) };
+			return QString::fromLatin1(text, 4).trimmed().toLower();
+		}
+
+		// ---- MP4 / QuickTime: walk box headers with seeks, never reading mdat or most of moov
+
+		struct Box
+		{
+			quint32 type = 0;
+			qint64 offset = 0;
+			qint64 size = 0;
+			qint64 headerSize = 0;
+
+			qint64 payload() const { return offset + headerSize; }
+			qint64 end() const { return offset + size; }
+		};
+
+		bool readBox(QFile& file, qint64 offset, qint64 end, Box& box)
+		{
+			uchar header[16];
+			if (offset + 8 > end || !file.seek(offset) || file.read(reinterpret_cast<char*>(header), sizeof(header)) < 8)
+				return false;
+
+			quint64 size = be32(header);
+			box.headerSize = 8;
+			if (size == 1)
+			{
+				if (offset + 16 > end)
+					return false;
+				size = be64(header + 8);
+				box.headerSize = 16;
+			}
+			else if (size == 0)
+			{
+				size = quint64(end - offset); // Runs to the end of its parent
+			}
+			if (size < quint64(box.headerSize) || size > quint64(end - offset))
+				return false;
+
+			box.type = be32(header + 4);
+			box.offset = offset;
+			box.size = qint64(size);
+			return true;
+		}
+
+		bool findChild(QFile& file, const Box& parent, quint32 type, Box& child, qint64 skip = 0)
+		{
+			qint64 pos = parent.payload() + skip;
+			for (int i = 0; i < 1024 && readBox(file, pos, parent.end(), child); ++i)
+			{
+				if (child.type == type)
+					return true;
+				pos = child.end();
+			}
+			return false;
+		}
+
+		QString mp4Codec(quint32 sampleEntry)
+		{
+			switch (sampleEntry)
+			{
+			case fourCC("avc1"): case fourCC("avc3"): return "h264";
+			case fourCC("hvc1"): case fourCC("hev1"): return "hevc";
+			case fourCC("av01"): return "av1";
+			case fourCC("vp09"): return "vp9";
+			case fourCC("mp4v"): return "mpeg4";
+			case fourCC("mp4a"): return "aac";
+			case fourCC("ac-3"): return "ac3";
+			case fourCC("ec-3"): return "eac3";
+			case fourCC("Opus"): return "opus";
+			case fourCC("fLaC"): return "flac";
+			case fourCC(".mp3"): return "mp3";
+			default: return fourCCString(sampleEntry);
+			}
+		}
+
+		bool probeMp4(QFile& file, const QByteArray& head, MediaInfo& info)
+		{
+			const auto* data = reinterpret_cast<const uchar*>(head.constData());
+			if (head.size() < 12 || be32(data + 4) != fourCC("ftyp"))
+				return false;
+
+			const quint32 brand = be32(data + 8);
+			const bool quickTime = brand == fourCC("qt  ");
+			info.container = quickTime ? "mov" : "mp4";
+
+			Box moov;
+			Box box;
+			bool haveMoov = false;
+			qint64 pos = 0;
+			for (int i = 0; i < 4096 && !haveMoov && readBox(file, pos, file.size(), box); ++i)
+			{
+				haveMoov = box.type == fourCC("moov");
+				moov = box;
+				pos = box.end();
+			}
+
+			bool hasVideo = false;
+			bool hasAudio = false;
+			if (haveMoov)
+			{
+				Box mvhd;
+				uchar header[32];
+				if (findChild(file, moov, fourCC("mvhd"), mvhd) && file.seek(mvhd.payload()) &&
+					file.read(reinterpret_cast<char*>(header), sizeof(header)) == sizeof(header))
+				{
+					const bool version1 = header[0] == 1;
+					const quint32 timescale = be32(header + (version1 ? 20 : 12));
+					const quint64 duration = version1 ? be64(header + 24) : be32(header + 16);
+					if (timescale > 0 && duration != 0xFFFFFFFFu && duration != ~quint64(0))
+						info.durationMs = qint64(duration * 1000 / timescale);
+				}
+
+				// moov/trak/mdia/{hdlr, minf/stbl/stsd}: the handler says what the track is, stsd names the codec
+				Box trak;
+				qint64 trakPos = 0;
+				while (findChild(file, moov, fourCC("trak"), trak, trakPos))
+				{
+					trakPos = trak.end() - moov.payload();
+					Box mdia, hdlr, minf, stbl, stsd;
+					uchar handler[12];
+					uchar entry[16];
+					if (!findChild(file, trak, fourCC("mdia"), mdia) || !findChild(file, mdia, fourCC("hdlr"), hdlr) ||
+						!file.seek(hdlr.payload()) || file.read(reinterpret_cast<char*>(handler), sizeof(handler)) != sizeof(handler))
+						continue;
+
+					const quint32 handlerType = be32(handler + 8);
+					if (handlerType != fourCC("vide") && handlerType != fourCC("soun"))
+						continue;
+					hasVideo = hasVideo || handlerType == fourCC("vide");
+					hasAudio = hasAudio || handlerType == fourCC("soun");
+
+					if (findChild(file, mdia, fourCC("minf"), minf) && findChild(file, minf, fourCC("stbl"), stbl) &&
+						findChild(file, stbl, fourCC("stsd"), stsd) && file.seek(stsd.payload()) &&
+						file.read(reinterpret_cast<char*>(entry), sizeof(entry)) == sizeof(entry))
+						info.codecs.append(mp4Codec(be32(entry + 12)));
+				}
+			}
+
+			const bool audioBrand = brand == fourCC("M4A ") || brand == fourCC("M4B ");
+			if (quickTime)
+				info.mimeType = "video/quicktime";
+			else if (audioBrand || (hasAudio && !hasVideo))
+				info.mimeType = "audio/mp4";
+			else
+				info.mimeType = "video/mp4";
+			return true;
+		}
+
+		// ---- Matroska / WebM: EBML elements in the head, Info and Tracks normally sit before the first Cluster
+
+		constexpr quint32 EbmlHeaderId = 0x1A45DFA3;
+		constexpr quint32 DocTypeId = 0x4282;
+		constexpr quint32 SegmentId = 0x18538067;
+		constexpr quint32 InfoId = 0x1549A966;
+		constexpr quint32 TimecodeScaleId = 0x2AD7B1;
+		constexpr quint32 DurationId = 0x4489;
+		constexpr quint32 TracksId = 0x1654AE6B;
+		constexpr quint32 TrackEntryId = 0xAE;
+		constexpr quint32 TrackTypeId = 0x83;
+		constexpr quint32 CodecIdId = 0x86;
+		constexpr quint32 ClusterId = 0x1F43B675;
+
+		struct MatroskaState
+		{
+			QByteArray docType;
+			quint64 timecodeScale = 1000000; // Nanoseconds per tick
+			double duration = -1.0;
+			QList<QPair<int, QByteArray>> tracks; // Track type and CodecID
+			bool reachedClusters = false;
+		};
+
+		bool readEbmlId(const uchar* p, qint64 available, quint32& id, int& length)
+		{
+			if (available < 1)
+				return false;
+			length = (p[0] & 0x80) ? 1 : (p[0] & 0x40) ? 2 : (p[0] & 0x20) ? 3 : (p[0] & 0x10) ? 4 : 0;
+			if (length == 0 || length > available)
+				return false;
+			id = 0;
+			for (int i = 0; i < length; ++i)
+				id = (id << 8) | p[i];
+			return true;
+		}
+
+		// Size -1 means "unknown", used by live-written Segments and Clusters
+		bool readEbmlSize(const uchar* p, qint64 available, qint64& size, int& length)
+		{
+			if (available < 1 || p[0] == 0)
+				return false;
+			length = 1;
+			quint8 mask = 0x80;
+			while (!(p[0] & mask))
+			{
+				mask >>= 1;
+				++length;
+			}
+			if (length > available)
+				return false;
+
+			quint64 value = p[0] & (mask - 1);
+			bool allOnes = value == quint64(mask - 1);
+			for (int i = 1; i < length; ++i)
+			{
+				value = (value << 8) | p[i];
+				allOnes = allOnes && p[i] == 0xFF;
+			}
+			size = allOnes ? -1 : qint64(value & 0x00FFFFFFFFFFFFFFull);
+			return true;
+		}
+
+		quint64 ebmlUnsigned(const uchar* p, qint64 size)
+		{
+			quint64 value = 0;
+			for (qint64 i = 0; i < size && i < 8; ++i)
+				value = (value << 8) | p[i];
+			return value;
+		}
+
+		void parseEbml(const uchar* p, qint64 available, int depth, MatroskaState& state)
+		{
+			qint64 pos = 0;
+			int trackType = 0;
+			QByteArray codecId;
+			while (pos < available && depth < 6 && !state.reachedClusters)
+			{
+				quint32 id;
+				qint64 size;
+				int idLength, sizeLength;
+				if (!readEbmlId(p + pos, available - pos, id, idLength) ||
+					!readEbmlSize(p + pos + idLength, available - pos - idLength, size, sizeLength))
+					break;
+
+				const qint64 dataStart = pos + idLength + sizeLength;
+				const qint64 inBuffer = available - dataStart;
+				if (id == ClusterId)
+				{
+					state.reachedClusters = true;
+					break;
+				}
+				if (size < 0 && id != SegmentId)
+					break; // Can't step over an unknown-size element we don't descend into
+
+				const qint64 length = size < 0 ? inBuffer : size;
+				if (id == EbmlHeaderId || id == SegmentId || id == InfoId || id == TracksId || id == TrackEntryId)
+				{
+					parseEbml(p + dataStart, qMin(length, inBuffer), depth + 1, state);
+				}
+				else if (length <= inBuffer)
+				{
+					const uchar* value = p + dataStart;
+					if (id == DocTypeId)
+						state.docType = QByteArray(reinterpret_cast<const char*>(value), length);
+					else if (id == TimecodeScaleId && length > 0)
+						state.timecodeScale = ebmlUnsigned(value, length);
+					else if (id == DurationId && length == 4)
+					{
+						const quint32 bits = be32(value);
+						float duration;
+						std::memcpy(&duration, &bits, sizeof(duration));
+						state.duration = duration;
+					}
+					else if (id == DurationId && length == 8)
+					{
+						const quint64 bits = be64(value);
+						double duration;
+						std::memcpy(&duration, &bits, sizeof(duration));
+						state.duration = duration;
+					}
+					else if (id == TrackTypeId)
+						trackType = int(ebmlUnsigned(value, length));
+					else if (id == CodecIdId)
+						codecId = QByteArray(reinterpret_cast<const char*>(value), length);
+				}
+				if (length > inBuffer)
+					break;
+				pos = dataStart + length;
+			}
+
+			if (!codecId.isEmpty())
+				state.tracks.append({ trackType, codecId });
+		}
+
+		QString matroskaCodec(const QByteArray& codecId)
+		{
+			static const QHash<QByteArray, QString> names = {
+				{ "V_MPEG4/ISO/AVC", "h264" }, { "V_MPEGH/ISO/HEVC", "hevc" }, { "V_AV1", "av1" },
+				{ "V_VP8", "vp8" }, { "V_VP9", "vp9" }, { "V_MPEG4/ISO/ASP", "mpeg4" }, { "V_MPEG2", "mpeg2" },
+				{ "A_AAC", "aac" }, { "A_OPUS", "opus" }, { "A_VORBIS", "vorbis" }, { "A_AC3", "ac3" },
+				{ "A_EAC3", "eac3" }, { "A_DTS", "dts" }, { "A_FLAC", "flac" }, { "A_MPEG/L3", "mp3" },
+				{ "A_TRUEHD", "truehd" }
+			};
+			// A_AAC/MPEG4/LC and friends
+			const QByteArray base = codecId.startsWith("A_AAC") ? QByteArray("A_AAC") : codecId;
+			return names.value(base, QString::fromLatin1(codecId).toLower());
+		}
+
+		bool probeMatroska(const QByteArray& head, MediaInfo& info)
+		{
+			const auto* data = reinterpret_cast<const uchar*>(head.constData());
+			if (head.size() < 4 || be32(data) != EbmlHeaderId)
+				return false;
+
+			MatroskaState state;
+			parseEbml(data, head.size(), 0, state);
+			if (state.docType != "webm" && state.docType != "matroska")
+				return false;
+
+			bool hasVideo = state.tracks.isEmpty(); // Tracks after the first Cluster: assume video
+			for (const auto& track : state.tracks)
+			{
+				hasVideo = hasVideo || track.first == 1;
+				info.codecs.append(matroskaCodec(track.second));
+			}
+
+			const bool webm = state.docType == "webm";
+			info.container = webm ? "webm" : "matroska";
+			if (webm)
+				info.mimeType = hasVideo ? "video/webm" : "audio/webm";
+			else
+				info.mimeType = hasVideo ? "video/x-matroska" : "audio/x-matroska";
+			if (state.duration > 0)
+				info.durationMs = qint64(state.duration * double(state.timecodeScale) / 1e6);
+			return true;
+		}
+
+		// ---- MP3 and FLAC, both possibly behind an ID3v2 tag
+
+		qint64 id3v2Size(const QByteArray& head)
+		{
+			const auto* data = reinterpret_cast<const uchar*>(head.constData());
+			if (head.size() < 10 || !head.startsWith("ID3"))
+				return 0;
+			const qint64 size = (qint64(data[6] & 0x7F) << 21) | (qint64(data[7] & 0x7F) << 14) |
+				(qint64(data[8] & 0x7F) << 7) | qint64(data[9] & 0x7F);
+			return 10 + size + ((data[5] & 0x10) ? 10 : 0); // Footer flag
+		}
+
+		struct Mp3Frame
+		{
+			int version = 0; // 1 = MPEG-1, 2 = MPEG-2, 3 = MPEG-2.5
+			int bitrate = 0; // kbit/s
+			int sampleRate = 0;
+			bool mono = false;
+		};
+
+		bool parseMp3Header(const uchar* p, Mp3Frame& frame)
+		{
+			static const int bitratesV1[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, -1 };
+			static const int bitratesV2[16] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, -1 };
+			static const int sampleRatesV1[4] = { 44100, 48000, 32000, -1 };
+
+			if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+				return false;
+			const int versionBits = (p[1] >> 3) & 3;
+			const int layerBits = (p[1] >> 1) & 3;
+			const int bitrateIndex = p[2] >> 4;
+			const int sampleRateIndex = (p[2] >> 2) & 3;
+			if (versionBits == 1 || layerBits != 1 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3)
+				return false; // Reserved values, free format, or not Layer III
+
+			frame.version = versionBits == 3 ? 1 : versionBits == 2 ? 2 : 3;
+			frame.bitrate = (frame.version == 1 ? bitratesV1 : bitratesV2)[bitrateIndex];
+			frame.sampleRate = sampleRatesV1[sampleRateIndex] >> (frame.version - 1);
+			frame.mono = (p[3] >> 6) == 3;
+			return true;
+		}
+
+		bool probeMp3(const QByteArray& audio, qint64 audioBytes, bool tagged, MediaInfo& info)
+		{
+			if (audio.size() < 4)
+				return false;
+			const auto* data = reinterpret_cast<const uchar*>(audio.constData());
+			Mp3Frame frame;
+			qint64 pos = 0;
+			// Untagged files must start with a frame; behind a tag a little padding is tolerated
+			const qint64 scanLimit = tagged ? qMin<qint64>(audio.size() - 4, 4096) : 1;
+			while (pos < scanLimit && !parseMp3Header(data + pos, frame))
+				++pos;
+			if (pos >= scanLimit)
+				return false;
+
+			info.container = "mp3";
+			info.mimeType = "audio/mpeg";
+			info.codecs.append("mp3");
+			audioBytes -= pos;
+
+			// A Xing/Info or VBRI header in the first frame gives the exact frame count of VBR files
+			const int samplesPerFrame = frame.version == 1 ? 1152 : 576;
+			const qint64 sideInfo = frame.version == 1 ? (frame.mono ? 17 : 32) : (frame.mono ? 9 : 17);
+			const qint64 xing = pos + 4 + sideInfo;
+			const qint64 vbri = pos + 4 + 32;
+			quint32 frames = 0;
+			if (xing + 12 <= audio.size() && (audio.mid(xing, 4) == "Xing" || audio.mid(xing, 4) == "Info") &&
+				(be32(data + xing + 4) & 1))
+				frames = be32(data + xing + 8);
+			else if (vbri + 18 <= audio.size() && audio.mid(vbri, 4) == "VBRI")
+				frames = be32(data + vbri + 14);
+
+			if (frames > 0)
+			{
+				info.durationMs = qint64(frames) * samplesPerFrame * 1000 / frame.sampleRate;
+				if (info.durationMs > 0)
+					info.bitrate = audioBytes * 8 * 1000 / info.durationMs;
+			}
+			else
+			{
+				info.bitrate = qint64(frame.bitrate) * 1000;
+				info.durationMs = audioBytes * 8 * 1000 / info.bitrate;
+			}
+			return true;
+		}
+
+		bool probeFlac(const QByteArray& audio, MediaInfo& info)
+		{
+			// "fLaC", then STREAMINFO is always the first metadata block
+			const auto* data = reinterpret_cast<const uchar*>(audio.constData());
+			if (audio.size() < 8 + 18 || !audio.startsWith("fLaC") || (data[4] & 0x7F) != 0)
+				return false;
+
+			const uchar* streamInfo = data + 8;
+			const quint32 sampleRate = (quint32(streamInfo[10]) << 12) | (quint32(streamInfo[11]) << 4) | (streamInfo[12] >> 4);
+			const quint64 totalSamples = (quint64(streamInfo[13] & 0x0F) << 32) | be32(streamInfo + 14);
+
+			info.container = "flac";
+			info.mimeType = "audio/flac";
+			info.codecs.append("flac");
+			if (sampleRate > 0 && totalSamples > 0)
+				info.durationMs = qint64(totalSamples * 1000 / sampleRate);
+			return true;
+		}
+
+		// ---- AVI: RIFF chunks, the hdrl list with avih and one strl per stream comes first
+
+		struct AviState
+		{
+			quint32 microSecPerFrame = 0;
+			quint32 totalFrames = 0;
+			quint32 streamType = 0; // fccType of the last strh, strf follows it
+			QStringList codecs;
+			bool hasVideo = false;
+		};
+
+		QString aviVideoCodec(quint32 handler)
+		{
+			const QString name = fourCCString(handler);
+			if (name == "h264" || name == "x264" || name == "avc1")
+				return "h264";
+			if (name == "xvid" || name == "divx" || name == "dx50" || name == "fmp4")
+				return "mpeg4";
+			if (name == "mjpg")
+				return "mjpeg";
+			return name;
+		}
+
+		QString aviAudioCodec(quint16 formatTag)
+		{
+			switch (formatTag)
+			{
+			case 0x0001: return "pcm";
+			case 0x0050: return "mp2";
+			case 0x0055: return "mp3";
+			case 0x00FF: case 0x1610: return "aac";
+			case 0x2000: return "ac3";
+			case 0x2001: return "dts";
+			default: return QString("0x%1").arg(formatTag, 4, 16, QChar('0'));
+			}
+		}
+
+		void parseRiff(const uchar* p, qint64 available, int depth, AviState& state)
+		{
+			qint64 pos = 0;
+			while (pos + 8 <= available && depth < 4)
+			{
+				const quint32 id = be32(p + pos);
+				const qint64 size = le32(p + pos + 4);
+				const uchar* value = p + pos + 8;
+				const qint64 inBuffer = qMin(size, available - pos - 8);
+
+				if (id == fourCC("LIST") && inBuffer >= 4)
+				{
+					const quint32 listType = be32(value);
+					if (listType == fourCC("movi"))
+						return; // Stream data from here on
+					if (listType == fourCC("hdrl") || listType == fourCC("strl"))
+						parseRiff(value + 4, inBuffer - 4, depth + 1, state);
+				}
+				else if (id == fourCC("avih") && inBuffer >= 20)
+				{
+					state.microSecPerFrame = le32(value);
+					state.totalFrames = le32(value + 16);
+				}
+				else if (id == fourCC("strh") && inBuffer >= 8)
+				{
+					state.streamType = be32(value);
+				}
+				else if (id == fourCC("strf"))
+				{
+					if (state.streamType == fourCC("vids") && inBuffer >= 20)
+					{
+						state.hasVideo = true;
+						state.codecs.append(aviVideoCodec(be32(value + 16))); // BITMAPINFOHEADER biCompression
+					}
+					else if (state.streamType == fourCC("auds") && inBuffer >= 2)
+					{
+						state.codecs.append(aviAudioCodec(le16(value))); // WAVEFORMATEX wFormatTag
+					}
+				}
+				pos += 8 + size + (size & 1); // Chunks are padded to even sizes
+			}
+		}
+
+		bool probeAvi(const QByteArray& head, MediaInfo& info)
+		{
+			const auto* data = reinterpret_cast<const uchar*>(head.constData());
+			if (head.size() < 12 || !head.startsWith("RIFF") || head.mid(8, 4) != "AVI ")
+				return false;
+
+			AviState state;
+			parseRiff(data + 12, head.size() - 12, 0, state);
+			info.container = "avi";
+			info.mimeType = "video/x-msvideo";
+			info.codecs = state.codecs;
+			if (state.microSecPerFrame > 0 && state.totalFrames > 0)
+				info.durationMs = qint64(state.microSecPerFrame) * state.totalFrames / 1000;
+			return true;
+		}
+
+		QJsonObject toJson(qint64 size, qint64 mtime, const MediaInfo& info)
+		{
+			return QJsonObject{
+				{ "size", size },
+				{ "mtime", mtime },
+				{ "mimeType", QString::fromLatin1(info.mimeType) },
+				{ "container", info.container },
+				{ "durationMs", info.durationMs },
+				{ "bitrate", info.bitrate },
+				{ "codecs", QJsonArray::fromStringList(info.codecs) }
+			};
+		}
+	}
+
+	MediaProbe& MediaProbe::instance()
+	{
+		static MediaProbe probe;
+		return probe;
+	}
+
+	MediaProbe::MediaProbe()
+	{
+		QCoreApplication* app = QCoreApplication::instance();
+		if (!app)
+			return; // No event loop to batch on, every change is written right away
+
+		// The first caller may be on any thread; the timer belongs to the application's
+		saveTimer = new QTimer();
+		saveTimer->setSingleShot(true);
+		saveTimer->setInterval(SaveDelayMs);
+		saveTimer->moveToThread(app->thread());
+		saveTimer->setParent(app);
+		QObject::connect(saveTimer, &QTimer::timeout, saveTimer, [this]() { saveIndex(); });
+		QObject::connect(app, &QCoreApplication::aboutToQuit, saveTimer, [this]() { saveIndex(); });
+	}
+
+	MediaInfo MediaProbe::probe(const QString& filePath)
+	{
+		const QFileInfo fileInfo(filePath);
+		const QString path = fileInfo.absoluteFilePath();
+		const qint64 size = fileInfo.size();
+		const qint64 mtime = fileInfo.lastModified().toMSecsSinceEpoch();
+
+		QMutexLocker locker(&mutex);
+		loadIndexLocked();
+		const auto it = index.constFind(path);
+		if (it != index.constEnd() && it->size == size && it->mtime == mtime)
+			return it->info;
+
+		// Reading the file is the slow part, don't hold other callers up behind it
+		locker.unlock();
+		MediaInfo info = probeFile(path);
+		if (info.mimeType.isEmpty())
+			info.mimeType = mimeTypeForExtension(path);
+		locker.relock();
+
+		// Unrecognised files are remembered too, or every scan of a library full of them would
+		// read each one again; a changed size or mtime still gets them probed afresh
+		if (fileInfo.exists())
+		{
+			index.insert(path, IndexEntry{ size, mtime, info });
+			indexDirty = true;
+			locker.unlock();
+			scheduleSave();
+		}
+		return info;
+	}
+
+	MediaInfo MediaProbe::probeFile(const QString& filePath)
+	{
+		MediaInfo info;
+		QFile file(filePath);
+		if (!file.open(QIODevice::ReadOnly))
+			return info;
+
+		const qint64 fileSize = file.size();
+		const QByteArray head = file.read(HeadSize);
+
+		if (!probeMp4(file, head, info) && !probeMatroska(head, info) && !probeAvi(head, info))
+		{
+			// MP3 and FLAC may sit behind an ID3v2 tag large enough (cover art) to push them out of the head
+			const qint64 tagSize = id3v2Size(head);
+			QByteArray audio = head.mid(tagSize);
+			if (tagSize > 0 && audio.size() < 4096 && tagSize < fileSize && file.seek(tagSize))
+				audio = file.read(HeadSize);
+
+			qint64 audioBytes = fileSize - tagSize;
+			if (fileSize >= 128 && file.seek(fileSize - 128) && file.read(3) == "TAG")
+				audioBytes -= 128; // ID3v1 trailer
+
+			if (!probeFlac(audio, info) && !probeMp3(audio, audioBytes, tagSize > 0, info))
+				return MediaInfo();
+		}
+
+		if (info.bitrate < 0 && info.durationMs > 0)
+			info.bitrate = fileSize * 8 * 1000 / info.durationMs;
+		return info;
+	}
+
+	QByteArray MediaProbe::mimeTypeForExtension(const QString& filePath)
+	{
+		static const QHash<QString, QByteArray> types = {
+			{ "mp4", "video/mp4" }, { "m4v", "video/mp4" }, { "m4a", "audio/mp4" }, { "mov", "video/quicktime" },
+			{ "mkv", "video/x-matroska" }, { "webm", "video/webm" }, { "mp3", "audio/mpeg" },
+			{ "flac", "audio/flac" }, { "avi", "video/x-msvideo" }
+		};
+		return types.value(QFileInfo(filePath).suffix().toLower(), "video/mp4");
+	}
+
+	void MediaProbe::setIndexPath(const QString& path)
+	{
+		saveIndex(); // Pending changes belong to the old index
+		QMutexLocker locker(&mutex);
+		indexPath = path;
+		index.clear();
+		indexLoaded = false;
+	}
+
+	void MediaProbe::loadIndexLocked()
+	{
+		if (indexLoaded)
+			return;
+		indexLoaded = true;
+
+		if (indexPath.isEmpty())
+			indexPath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/media-probe.json";
+
+		QFile file(indexPath);
+		if (!file.open(QIODevice::ReadOnly))
+			return;
+
+		const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+		if (root.value("version").toInt() != IndexVersion)
+			return;
+
+		const QJsonObject files = root.value("files").toObject();
+		for (auto it = files.constBegin(); it != files.constEnd(); ++it)
+		{
+			const QJsonObject entry = it.value().toObject();
+			IndexEntry indexEntry;
+			indexEntry.size = entry.value("size").toInteger();
+			indexEntry.mtime = entry.value("mtime").toInteger();
+			indexEntry.info.mimeType = entry.value("mimeType").toString().toLatin1();
+			indexEntry.info.container = entry.value("container").toString();
+			indexEntry.info.durationMs = entry.value("durationMs").toInteger(-1);
+			indexEntry.info.bitrate = entry.value("bitrate").toInteger(-1);
+			for (const QJsonValue& codec : entry.value("codecs").toArray())
+				indexEntry.info.codecs.append(codec.toString());
+			index.insert(it.key(), indexEntry);
+		}
+		qDebug() << "Loaded" << index.size() << "probed media files from" << indexPath;
+	}
+
+	void MediaProbe::scheduleSave()
+	{
+		// Probes run on any thread, the timer belongs to the application's
+		if (saveTimer)
+			QMetaObject::invokeMethod(saveTimer, qOverload<>(&QTimer::start), Qt::AutoConnection);
+		else
+			saveIndex();
+	}
+
+	void MediaProbe::saveIndex()
+	{
+		QMutexLocker saveLocker(&saveMutex);
+
+		QHash<QString, IndexEntry> entries;
+		QString path;
+		{
+			QMutexLocker locker(&mutex);
+			if (!indexDirty)
+				return;
+			indexDirty = false;
+			entries = index; // Implicitly shared, the copy happens only if a probe adds meanwhile
+			path = indexPath;
+		}
+
+		// Over the cap, entries for files that are gone or changed go first, then arbitrary ones.
+		// Stat'ing them is slow, so it happens on the snapshot and only the verdict is applied.
+		if (entries.size() > MaxIndexEntries)
+		{
+			QStringList stale;
+			for (auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+			{
+				const QFileInfo fileInfo(it.key());
+				if (!fileInfo.exists() || fileInfo.size() != it->size || fileInfo.lastModified().toMSecsSinceEpoch() != it->mtime)
+					stale.append(it.key());
+			}
+
+			QMutexLocker locker(&mutex);
+			for (const QString& key : stale)
+			{
+				const auto it = index.constFind(key);
+				if (it != index.constEnd() && it->size == entries.value(key).size && it->mtime == entries.value(key).mtime)
+					index.erase(it);
+			}
+			while (index.size() > MaxIndexEntries)
+				index.erase(index.begin());
+			entries = index;
+		}
+
+		QJsonObject files;
+		for (auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+			files.insert(it.key(), toJson(it->size, it->mtime, it->info));
+
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QSaveFile file(path);
+		if (!file.open(QIODevice::WriteOnly))
+		{
+			qWarning() << "Cannot write media probe index" << path << ":" << file.errorString();
+			return;
+		}
+		file.write(QJsonDocument(QJsonObject{ { "version", IndexVersion }, { "files", files } }).toJson(QJsonDocument::Compact));
+		if (!file.commit())
+			qWarning() << "Cannot write media probe index" << path << ":" << file.errorString();
+	}
+}
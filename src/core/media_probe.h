@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+
+class QTimer;
+
+namespace CastIt
+{
+	// What the container header says about a media file. Fields the probe couldn't find stay -1 or empty.
+	struct MediaInfo
+	{
+		QByteArray mimeType;
+		QString container; // "mp4", "mov", "matroska", "webm", "mp3", "flac" or "avi"; empty if unrecognised
+		qint64 durationMs = -1;
+		qint64 bitrate = -1; // Average over the whole file, bits per second
+		QStringList codecs; // Short names such as "h264" or "aac", one per track
+
+		bool isValid() const { return !container.isEmpty(); }
+	};
+
+	// Identifies media files from their container headers rather than their extension. Only the first
+	// 64 KiB, the last 128 bytes and, for MP4, a handful of box headers are read. Results are kept in an
+	// on-disk index keyed by path, size and mtime, so repeat casts from a large library never touch the file.
+	class MediaProbe
+	{
+	public:
+		static constexpr int SaveDelayMs = 2000; // A library scan probes many files in a row
+
+		static MediaProbe& instance();
+
+		// Cached, unrecognised files included. For those the MIME type falls back to the extension.
+		MediaInfo probe(const QString& filePath);
+		static MediaInfo probeFile(const QString& filePath); // Uncached, always reads the file
+		static QByteArray mimeTypeForExtension(const QString& filePath);
+
+		void setIndexPath(const QString& path); // Defaults to media-probe.json in the cache location
+		void saveIndex(); // Writes pending changes now; otherwise they go out SaveDelayMs after the last one
+
+	private:
+		struct IndexEntry
+		{
+			qint64 size = 0;
+			qint64 mtime = 0;
+			MediaInfo info;
+		};
+
+		MediaProbe();
+
+		QMutex mutex;
+		QHash<QString, IndexEntry> index; // By absolute path
+		QString indexPath;
+		bool indexLoaded = false;
+		bool indexDirty = false;
+		QMutex saveMutex; // Serialises writers, so an older snapshot never lands after a newer one
+		QPointer<QTimer> saveTimer; // Lives on the application's thread, gone once it quits
+
+		void loadIndexLocked();
+		void scheduleSave();
+	};
+}
@@ -0,0 +1,231 @@
+#include "media_server.h"
+#include "media_worker.h"
+#include "fanout_buffer.h"
+#include "media_probe.h"
+#include "network_interface_monitor.h"
+#include "token_bucket.h"
+#include <QCoreApplication>
+#include <QTcpServer>
+#include <QThread>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <QFileInfo>
+#include <QUrl>
+#include <QDebug>
+#include <functional>
+
+namespace CastIt
+{
+	namespace
+	{
+		// Hands raw descriptors to the server instead of creating QTcpSockets on the GUI thread
+		class MediaListener : public QTcpServer
+		{
+		public:
+			MediaListener(std::function<void(qintptr)> dispatch, QObject* parent)
+				: QTcpServer(parent), dispatch(std::move(dispatch))
+			{
+			}
+
+		protected:
+			void incomingConnection(qintptr socketDescriptor) override
+			{
+				dispatch(socketDescriptor);
+			}
+
+		private:
+			std::function<void(qintptr)> dispatch;
+		};
+	}
+
+	MediaServer* MediaServer::instance()
+	{
+		// Parented to the application so it is torn down with the event loop, not after it
+		static MediaServer* server = new MediaServer(qBound(2, QThread::idealThreadCount(), 16),
+			QCoreApplication::instance());
+		return server;
+	}
+
+	MediaServer::MediaServer(int workerCount, QObject* parent) : QObject(parent),
+		server(new MediaListener([this](qintptr socketDescriptor) { dispatchConnection(socketDescriptor); }, this)),
+		metricsTimer(new QTimer(this))
+	{
+		qRegisterMetaType<CastIt::MediaMetrics::Snapshot>();
+		metricsTimer->setInterval(1000);
+		connect(metricsTimer, &QTimer::timeout, this, &MediaServer::publishMetrics);
+
+		for (int i = 0; i < workerCount; ++i)
+		{
+			QThread* thread = new QThread(this);
+			thread->setObjectName(QString("MediaIO-%1").arg(i));
+			MediaWorker* worker = new MediaWorker(this);
+			worker->moveToThread(thread);
+			connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+			thread->start();
+
+			threads.append(thread);
+			workers.append(worker);
+		}
+	}
+
+	MediaServer::~MediaServer()
+	{
+		server->close();
+		for (QThread* thread : threads)
+		{
+			thread->quit();
+			thread->wait();
+		}
+	}
+
+	bool MediaServer::ensureListening()
+	{
+		if (server->isListening())
+			return true;
+
+		if (!server->listen(QHostAddress::Any, 0))
+		{
+			lastError = server->errorString();
+			qWarning() << "Failed to start media server:" << lastError;
+			return false;
+		}
+		qDebug() << "Media server listening on port" << server->serverPort();
+		metricsClock.start();
+		metricsTimer->start();
+		return true;
+	}
+
+	QString MediaServer::publish(const QString& filePath, const QByteArray& mimeType, bool fanout)
+	{
+		if (!ensureListening())
+			return QString();
+
+		// 128 random bits: renderers on the LAN can't enumerate other sessions' files
+		quint64 bits[2];
+		QRandomGenerator::system()->fillRange(bits);
+		const QString token = QString::fromLatin1(QByteArray(reinterpret_cast<const char*>(bits), sizeof(bits)).toHex());
+
+		Publication publication;
+		publication.filePath = filePath;
+		publication.mimeType = mimeType;
+		if (fanout)
+			publication.fanout = std::make_shared<FanoutBuffer>(filePath);
+		// MP4 and QuickTime files with a trailing moov are served as if they were faststart
+		publication.faststart = mimeType == "video/mp4" || mimeType == "audio/mp4" || mimeType == "video/quicktime";
+
+		// The probe is cached, so this costs nothing for a file the controller just probed
+		const qint64 bitrate = MediaProbe::instance().probe(filePath).bitrate;
+		if (bitrate > 0 && paceHeadroom > 0)
+		{
+			publication.paceBytesPerSecond = qint64(double(bitrate) / 8.0 * paceHeadroom);
+			publication.burstBytes = qMax<qint64>(bitrate / 8 * burstWindowMs / 1000, 256 * 1024);
+		}
+
+		QWriteLocker locker(&publicationsLock);
+		publications.insert(token, publication);
+		qDebug() << "Published" << filePath << "as" << token;
+		return token;
+	}
+
+	void MediaServer::unpublish(const QString& token)
+	{
+		QWriteLocker locker(&publicationsLock);
+		publications.remove(token);
+	}
+
+	bool MediaServer::lookup(QByteArrayView token, Publication& publication) const
+	{
+		QReadLocker locker(&publicationsLock);
+		const auto it = publications.constFind(QString::fromLatin1(token));
+		if (it == publications.constEnd())
+			return false;
+		publication = it.value();
+		return true;
+	}
+
+	void MediaServer::setPacing(double headroom, int burstMs)
+	{
+		paceHeadroom = qMax(0.0, headroom);
+		burstWindowMs = qMax(0, burstMs);
+	}
+
+	void MediaServer::setEgressLimit(qint64 bytesPerSecond)
+	{
+		EgressLimiter::instance().setLimit(bytesPerSecond);
+	}
+
+	QString MediaServer::urlFor(const QString& token, const QHostAddress& renderer, int interfaceIndex) const
+	{
+		Publication publication;
+		if (!lookup(QStringView(token).toLatin1(), publication) || !server->isListening())
+			return QString();
+
+		QHostAddress host = localAddress();
+		if (!renderer.isNull() || interfaceIndex > 0)
+		{
+			const QHostAddress reachable = NetworkInterfaceMonitor::instance()->localAddressFor(renderer, interfaceIndex);
+			if (!reachable.isNull())
+				host = reachable;
+		}
+		QUrl url;
+		url.setScheme("http");
+		url.setHost(host.toString()); // Brackets IPv6 literals, the zone of a link-local one included
+		url.setPort(server->serverPort());
+
+		// The file name is cosmetic, some renderers pick a demuxer from the extension
+		const QByteArray fileName = QUrl::toPercentEncoding(QFileInfo(publication.filePath).fileName());
+		return url.toString(QUrl::FullyEncoded) + QString("/media/%1/%2").arg(token, QString::fromLatin1(fileName));
+	}
+
+	quint16 MediaServer::port() const
+	{
+		return server->serverPort();
+	}
+
+	void MediaServer::dispatchConnection(qintptr socketDescriptor)
+	{
+		// Least-loaded worker, so long-lived streams don't pile up on one thread. The scan starts
+		// after the last pick because counts only move once the worker has adopted the socket.
+		const int count = workers.size();
+		int best = nextWorker % count;
+		for (int i = 1; i < count; ++i)
+		{
+			const int candidate = (nextWorker + i) % count;
+			if (workers[candidate]->connectionCount() < workers[best]->connectionCount())
+				best = candidate;
+		}
+		nextWorker = best + 1;
+
+		MediaWorker* target = workers[best];
+		QMetaObject::invokeMethod(target, [target, socketDescriptor]()
+			{
+				target->adoptConnection(socketDescriptor);
+			}, Qt::QueuedConnection);
+	}
+
+	MediaMetrics::Snapshot MediaServer::metrics() const
+	{
+		MediaMetrics::Snapshot snapshot = MediaMetrics::instance().snapshot();
+		snapshot.throughput = lastThroughput;
+		return snapshot;
+	}
+
+	void MediaServer::publishMetrics()
+	{
+		// Aggregate throughput over the last interval, from the byte counter every stream feeds
+		MediaMetrics::Snapshot snapshot = MediaMetrics::instance().snapshot();
+		const qint64 elapsedMs = metricsClock.restart();
+		if (elapsedMs > 0)
+			lastThroughput = double(snapshot.bytesSent - lastBytesSent) * 1000.0 / double(elapsedMs);
+		lastBytesSent = snapshot.bytesSent;
+		snapshot.throughput = lastThroughput;
+		emit metricsUpdated(snapshot);
+	}
+
+	QHostAddress MediaServer::localAddress()
+	{
+		// First IPv4 address of an interface that is up and not loopback
+		const QHostAddress address = NetworkInterfaceMonitor::instance()->primaryIPv4();
+		return address.isNull() ? QHostAddress(QHostAddress::LocalHost) : address;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QHostAddress>
+#include <QList>
+#include <QReadWriteLock>
+#include <QElapsedTimer>
+#include "media_stream.h"
+#include "media_metrics.h"
+
+class QTcpServer;
+class QThread;
+class QTimer;
+
+namespace CastIt
+{
+	class MediaWorker;
+
+	// Process-wide HTTP server that publishes local files to renderers. Every cast gets its own
+	// unguessable token, so many files can be shared at once from a single listening socket.
+	// Accepted connections are spread over a pool of I/O threads, each running its own event loop.
+	class MediaServer : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		using Publication = MediaSource;
+
+		static MediaServer* instance(); // Created on first use, lives until the application quits
+		~MediaServer() override;
+
+		// Returns the session token. With fanout, every client shares one sequential read of the file.
+		QString publish(const QString& filePath, const QByteArray& mimeType, bool fanout = false);
+		void unpublish(const QString& token);
+		bool lookup(QByteArrayView token, Publication& publication) const; // Thread-safe
+
+		// Streams are paced at headroom times the file's bitrate after an initial burst of burstMs
+		// of media. Applies to files published afterwards; a headroom of 0 disables pacing.
+		void setPacing(double headroom, int burstMs);
+		void setEgressLimit(qint64 bytesPerSecond); // Shared by all streams, 0 removes the cap
+
+		// Absolute URL a renderer on the LAN can fetch. With the renderer's address (and the
+		// interface it was discovered on), the host is one of our addresses that renderer can reach.
+		QString urlFor(const QString& token, const QHostAddress& renderer = QHostAddress(), int interfaceIndex = 0) const;
+		quint16 port() const;
+		QString errorString() const { return lastError; }
+		int workerCount() const { return workers.size(); }
+
+		// Also scraped in Prometheus format from GET /metrics, answered on loopback connections only
+		MediaMetrics::Snapshot metrics() const;
+
+	signals:
+		void metricsUpdated(const CastIt::MediaMetrics::Snapshot& snapshot); // Once a second while listening
+
+	private:
+		explicit MediaServer(int workerCount, QObject* parent = nullptr);
+
+		QTcpServer* server;
+		QList<QThread*> threads;
+		QList<MediaWorker*> workers;
+		int nextWorker = 0;
+		mutable QReadWriteLock publicationsLock;
+		QHash<QString, Publication> publications;
+		QString lastError;
+		double paceHeadroom = 2.0; // Renderers must be able to refill their buffer after a stall or seek
+		int burstWindowMs = 8000;
+		QTimer* metricsTimer;
+		QElapsedTimer metricsClock;
+		qint64 lastBytesSent = 0;
+		double lastThroughput = 0.0;
+
+		bool ensureListening();
+		void dispatchConnection(qintptr socketDescriptor);
+		void publishMetrics();
+		static QHostAddress localAddress();
+	};
+}
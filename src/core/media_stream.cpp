@@ -0,0 +1,478 @@
+#include "media_stream.h"
+#include "chunk_cache.h"
+#include "fanout_buffer.h"
+#include "mp4_layout.h"
+#include "token_bucket.h"
+#include "media_metrics.h"
+#include <QTcpSocket>
+#include <QTimer>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <cstring>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr qint64 StreamChunkSize = 64 * 1024; // Largest single write handed to the socket
+		constexpr qint64 SocketHighWatermark = 256 * 1024; // Stop refilling above this many unsent bytes
+		constexpr qint64 PacingQuantum = 16 * 1024; // Paced streams wait for at least this much allowance
+		constexpr int MaxRangesPerRequest = 32; // More than this is treated as abuse and ignored
+
+		bool parseOffset(QByteArrayView text, qint64& value)
+		{
+			if (text.isEmpty())
+				return false;
+			for (char c : text)
+			{
+				if (c < '0' || c > '9')
+					return false;
+			}
+			bool ok = false;
+			value = text.toLongLong(&ok);
+			return ok;
+		}
+
+		const char* reasonPhrase(int statusCode)
+		{
+			switch (statusCode)
+			{
+			case 200: return "OK";
+			case 206: return "Partial Content";
+			case 400: return "Bad Request";
+			case 404: return "Not Found";
+			case 405: return "Method Not Allowed";
+			case 406: return "Not Acceptable";
+			case 416: return "Range Not Satisfiable";
+			default: return "Internal Server Error";
+			}
+		}
+
+		QByteArray statusLine(int statusCode)
+		{
+			return "HTTP/1.1 " + QByteArray::number(statusCode) + ' ' + reasonPhrase(statusCode) + "\r\n";
+		}
+	}
+
+	RangeParseResult parseRangeHeader(QByteArrayView header, qint64 fileSize, QList<ByteRange>& ranges)
+	{
+		ranges.clear();
+		header = header.trimmed();
+		if (header.size() < 6 || qstrnicmp(header.data(), "bytes=", 6) != 0)
+			return RangeParseResult::NoRange;
+
+		const QByteArrayView specs = header.sliced(6);
+		qsizetype from = 0;
+		int specCount = 0;
+		while (from <= specs.size())
+		{
+			qsizetype comma = specs.indexOf(',', from);
+			if (comma < 0)
+				comma = specs.size();
+			const QByteArrayView spec = specs.sliced(from, comma - from).trimmed();
+			from = comma + 1;
+
+			if (spec.isEmpty())
+				continue; // Tolerate "bytes=0-1,,2-3"
+			if (++specCount > MaxRangesPerRequest)
+				return RangeParseResult::NoRange;
+
+			const qsizetype dash = spec.indexOf('-');
+			if (dash < 0)
+				return RangeParseResult::NoRange;
+
+			const QByteArrayView firstText = spec.first(dash);
+			const QByteArrayView lastText = spec.sliced(dash + 1);
+			ByteRange range;
+
+			if (firstText.isEmpty())
+			{
+				// Suffix range: the last N bytes
+				qint64 suffix = 0;
+				if (!parseOffset(lastText, suffix))
+					return RangeParseResult::NoRange;
+				if (suffix == 0 || fileSize == 0)
+					continue;
+				range.first = qMax<qint64>(0, fileSize - suffix);
+				range.last = fileSize - 1;
+			}
+			else
+			{
+				if (!parseOffset(firstText, range.first))
+					return RangeParseResult::NoRange;
+				if (lastText.isEmpty())
+				{
+					range.last = fileSize - 1;
+				}
+				else
+				{
+					if (!parseOffset(lastText, range.last) || range.last < range.first)
+						return RangeParseResult::NoRange;
+					range.last = qMin(range.last, fileSize - 1);
+				}
+				if (range.first >= fileSize)
+					continue;
+			}
+			ranges.append(range);
+		}
+
+		return ranges.isEmpty() ? RangeParseResult::Unsatisfiable : RangeParseResult::Satisfiable;
+	}
+
+	MediaBody::MediaBody(const MediaSource& source, const QList<ByteRange>& ranges,
+		std::shared_ptr<const Mp4Layout> layout, QObject* parent)
+		: QIODevice(parent), file(source.filePath), ranges(ranges), mimeType(source.mimeType),
+		fanout(source.fanout), layout(std::move(layout))
+	{
+		totalFileSize = this->layout ? this->layout->size() : QFileInfo(source.filePath).size();
+		cacheFileId = ChunkCache::fileId(source.filePath);
+		if (this->fanout)
+			fanoutCursor = this->fanout->attachCursor();
+		if (this->ranges.size() > 1)
+		{
+			boundary = "CASTIT_" + QByteArray::number(QRandomGenerator::global()->generate64(), 16);
+		}
+		buildSegments();
+	}
+
+	MediaBody::~MediaBody()
+	{
+		close();
+		if (fanout)
+			fanout->detachCursor(fanoutCursor);
+	}
+
+	bool MediaBody::open(OpenMode mode)
+	{
+		if ((mode & WriteOnly) || !file.open(QIODevice::ReadOnly))
+			return false;
+		// Unbuffered so pos() inside readData() is the real read position, like QBuffer
+		return QIODevice::open(mode | QIODevice::Unbuffered);
+	}
+
+	void MediaBody::close()
+	{
+		chunk = QByteArray();
+		chunkIndex = -1;
+		file.close();
+		QIODevice::close();
+	}
+
+	QByteArray MediaBody::contentType() const
+	{
+		if (isMultipart())
+			return "multipart/byteranges; boundary=" + boundary;
+		return mimeType;
+	}
+
+	QByteArray MediaBody::contentRange() const
+	{
+		if (ranges.size() != 1)
+			return QByteArray();
+		return "bytes " + QByteArray::number(ranges.first().first) + '-' +
+			QByteArray::number(ranges.first().last) + '/' + QByteArray::number(totalFileSize);
+	}
+
+	void MediaBody::appendSegment(qint64 length, qint64 fileOffset, const QByteArray& inlineData, qint64 inlineOffset)
+	{
+		if (length <= 0)
+			return;
+		Segment segment;
+		segment.bodyOffset = bodySize;
+		segment.length = length;
+		segment.fileOffset = fileOffset;
+		segment.inlineData = inlineData;
+		segment.inlineOffset = inlineOffset;
+		segments.append(segment);
+		bodySize += length;
+	}
+
+	void MediaBody::appendRange(const ByteRange& range)
+	{
+		if (!layout)
+		{
+			appendSegment(range.length(), range.first, QByteArray());
+			return;
+		}
+
+		// Map the virtual range onto the layout's pieces; the patched moov stays shared, not copied
+		for (const Mp4Layout::Piece& piece : layout->pieces())
+		{
+			const qint64 start = qMax(range.first, piece.virtualOffset);
+			const qint64 end = qMin(range.last + 1, piece.virtualOffset + piece.length);
+			if (start >= end)
+				continue;
+			const qint64 within = start - piece.virtualOffset;
+			if (piece.fileOffset >= 0)
+				appendSegment(end - start, piece.fileOffset + within, QByteArray());
+			else
+				appendSegment(end - start, -1, piece.data, within);
+		}
+	}
+
+	void MediaBody::buildSegments()
+	{
+		segments.clear();
+		bodySize = 0;
+
+		if (!isMultipart())
+		{
+			for (const ByteRange& range : ranges)
+				appendRange(range);
+			return;
+		}
+
+		for (const ByteRange& range : ranges)
+		{
+			const QByteArray partHeader = "\r\n--" + boundary + "\r\n"
+				"Content-Type: " + mimeType + "\r\n"
+				"Content-Range: bytes " + QByteArray::number(range.first) + '-' + QByteArray::number(range.last) +
+				'/' + QByteArray::number(totalFileSize) + "\r\n\r\n";
+			appendSegment(partHeader.size(), -1, partHeader);
+			appendRange(range);
+		}
+		const QByteArray trailer = "\r\n--" + boundary + "--\r\n";
+		appendSegment(trailer.size(), -1, trailer);
+	}
+
+	const MediaBody::Segment* MediaBody::segmentAt(qint64 bodyPos) const
+	{
+		// Segments are few (a handful per range at most), a linear scan is cheaper than anything clever
+		for (const Segment& segment : segments)
+		{
+			if (bodyPos >= segment.bodyOffset && bodyPos < segment.bodyOffset + segment.length)
+				return &segment;
+		}
+		return nullptr;
+	}
+
+	QByteArrayView MediaBody::fileSpan(qint64 fileOffset, qint64 maxSize)
+	{
+		const qint64 index = fileOffset / ChunkCache::ChunkSize;
+		if (index != chunkIndex)
+		{
+			chunk = fanout ? fanout->chunk(fanoutCursor, index, file)
+				: ChunkCache::instance().chunk(cacheFileId, file, index);
+			chunkIndex = chunk.isEmpty() ? -1 : index;
+		}
+
+		const qint64 within = fileOffset - index * ChunkCache::ChunkSize;
+		if (within >= chunk.size())
+			return QByteArrayView();
+		return QByteArrayView(chunk.constData() + within, qMin(maxSize, chunk.size() - within));
+	}
+
+	QByteArrayView MediaBody::peekSpan(qint64 maxSize)
+	{
+		const qint64 bodyPos = pos();
+		const Segment* segment = segmentAt(bodyPos);
+		if (!segment || maxSize <= 0)
+			return QByteArrayView();
+
+		const qint64 within = bodyPos - segment->bodyOffset;
+		const qint64 available = qMin(maxSize, segment->length - within);
+		if (segment->fileOffset < 0)
+			return QByteArrayView(segment->inlineData.constData() + segment->inlineOffset + within, available);
+		return fileSpan(segment->fileOffset + within, available);
+	}
+
+	qint64 MediaBody::readData(char* data, qint64 maxSize)
+	{
+		const qint64 start = pos();
+		qint64 copied = 0;
+		while (copied < maxSize && start + copied < bodySize)
+		{
+			// peekSpan() works on pos(), which only moves after readData() returns
+			const qint64 bodyPos = start + copied;
+			const Segment* segment = segmentAt(bodyPos);
+			if (!segment)
+				break;
+
+			const qint64 within = bodyPos - segment->bodyOffset;
+			const qint64 wanted = qMin(maxSize - copied, segment->length - within);
+			const QByteArrayView span = segment->fileOffset < 0
+				? QByteArrayView(segment->inlineData.constData() + segment->inlineOffset + within, wanted)
+				: fileSpan(segment->fileOffset + within, wanted);
+			if (span.isEmpty())
+				break;
+
+			std::memcpy(data + copied, span.data(), span.size());
+			copied += span.size();
+		}
+
+		if (copied == 0 && start < bodySize)
+			return -1;
+		return copied;
+	}
+
+	qint64 MediaBody::writeData(const char* data, qint64 maxSize)
+	{
+		Q_UNUSED(data);
+		Q_UNUSED(maxSize);
+		return -1;
+	}
+
+	MediaStream::MediaStream(QTcpSocket* socket, MediaBody* body, TokenBucket* pacer,
+		std::shared_ptr<ConnectionMetrics> metrics, QObject* parent)
+		: QObject(parent), socket(socket), body(body), pacer(pacer), resumeTimer(new QTimer(this)),
+		metrics(std::move(metrics))
+	{
+		body->setParent(this);
+		resumeTimer->setSingleShot(true);
+		resumeTimer->setTimerType(Qt::PreciseTimer);
+		connect(resumeTimer, &QTimer::timeout, this, &MediaStream::pump);
+		connect(socket, &QTcpSocket::bytesWritten, this, &MediaStream::pump);
+	}
+
+	MediaStream::~MediaStream()
+	{
+		// Torn down with its connection before the body was out: the client went away mid-transfer
+		if (!done && metrics)
+			MediaMetrics::instance().recordAbort(*metrics);
+	}
+
+	void MediaStream::start(const QByteArray& header, const QElapsedTimer& requestClock)
+	{
+		this->requestClock = requestClock;
+		if (!socket)
+			return;
+		socket->write(header);
+		pump();
+	}
+
+	void MediaStream::pump()
+	{
+		if (done || !socket || resumeTimer->isActive())
+			return;
+
+		while (socket->bytesToWrite() < SocketHighWatermark)
+		{
+			if (body->pos() >= body->size())
+			{
+				done = true;
+				if (metrics && transferClock.isValid())
+					MediaMetrics::instance().recordTransfer(*metrics, body->size(), transferClock.nsecsElapsed());
+				emit finished();
+				return;
+			}
+
+			// Pacing: the connection's bucket first, then the global cap. Waiting for a whole
+			// quantum keeps a throttled stream from degenerating into a trickle of tiny writes.
+			qint64 allowed = qMin(StreamChunkSize, body->size() - body->pos());
+			const qint64 quantum = qMin(PacingQuantum, allowed);
+			if (pacer && pacer->isLimited())
+			{
+				allowed = qMin(allowed, pacer->available());
+				if (allowed < quantum)
+				{
+					resumeTimer->start(pacer->msUntilAvailable(quantum));
+					return;
+				}
+			}
+
+			// Hand the socket a view straight into the cached chunk; it copies once into its own buffer
+			const QByteArrayView span = body->peekSpan(allowed);
+			const qint64 granted = span.isEmpty() ? 0 : EgressLimiter::instance().take(span.size(), qMin(quantum, span.size()));
+			if (!span.isEmpty() && granted == 0)
+			{
+				resumeTimer->start(EgressLimiter::instance().msUntilAvailable(quantum));
+				return;
+			}
+
+			const qint64 written = span.isEmpty() ? -1 : socket->write(span.data(), granted);
+			if (written <= 0)
+			{
+				qWarning() << "Media stream aborted at body offset" << body->pos();
+				done = true;
+				if (metrics)
+					MediaMetrics::instance().recordAbort(*metrics);
+				socket->abort();
+				return;
+			}
+			if (pacer)
+				pacer->consume(written);
+			if (metrics)
+			{
+				if (!transferClock.isValid())
+				{
+					transferClock.start();
+					if (requestClock.isValid())
+						MediaMetrics::instance().recordFirstByte(*metrics, requestClock.nsecsElapsed());
+				}
+				MediaMetrics::instance().recordBytes(*metrics, written);
+			}
+			body->seek(body->pos() + written);
+		}
+	}
+
+	QByteArray MediaResponse::headerBlock(bool keepAlive) const
+	{
+		QByteArray block = statusLine(statusCode);
+		for (const auto& header : headers)
+			block += header.first + ": " + header.second + "\r\n";
+		block += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+		return block;
+	}
+
+	MediaResponse errorResponse(int statusCode)
+	{
+		MediaResponse response;
+		response.statusCode = statusCode;
+		response.headers = { { "Content-Length", "0" } };
+		return response;
+	}
+
+	MediaResponse prepareMediaResponse(const MediaSource& source, bool headOnly, QByteArrayView rangeHeader)
+	{
+		MediaResponse response;
+
+		const QFileInfo fileInfo(source.filePath);
+		if (!fileInfo.isFile())
+			return errorResponse(404);
+
+		// Ranges are resolved against the virtual faststart file when the MP4 needs one
+		std::shared_ptr<const Mp4Layout> layout = source.faststart ? Mp4Layout::forFile(source.filePath) : nullptr;
+		const qint64 fileSize = layout ? layout->size() : fileInfo.size();
+		QList<ByteRange> ranges;
+		const RangeParseResult rangeResult = parseRangeHeader(rangeHeader, fileSize, ranges);
+		if (rangeResult == RangeParseResult::Unsatisfiable)
+		{
+			response.statusCode = 416;
+			response.headers = {
+				{ "Content-Range", "bytes */" + QByteArray::number(fileSize) },
+				{ "Content-Length", "0" }
+			};
+			return response;
+		}
+		if (rangeResult == RangeParseResult::NoRange)
+		{
+			ranges.clear();
+			if (fileSize > 0)
+				ranges.append(ByteRange{ 0, fileSize - 1 });
+		}
+
+		MediaSource bodySource = source;
+		if (headOnly)
+			bodySource.fanout.reset(); // A HEAD never reads, so it takes no cursor in the pipeline
+		auto* body = new MediaBody(bodySource, ranges, layout);
+		if (!headOnly && !body->open(QIODevice::ReadOnly))
+		{
+			delete body;
+			return errorResponse(404);
+		}
+
+		response.statusCode = rangeResult == RangeParseResult::Satisfiable ? 206 : 200;
+		response.headers.append({ "Content-Type", body->contentType() });
+		response.headers.append({ "Content-Length", QByteArray::number(body->size()) });
+		if (response.statusCode == 206 && !body->isMultipart())
+			response.headers.append({ "Content-Range", body->contentRange() });
+		response.headers.append({ "Accept-Ranges", "bytes" });
+
+		if (headOnly)
+			delete body;
+		else
+			response.body = body;
+		return response;
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <QObject>
+#include <QIODevice>
+#include <QFile>
+#include <QList>
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QPointer>
+#include <QPair>
+#include <QElapsedTimer>
+#include <memory>
+
+class QTcpSocket;
+class QTimer;
+
+namespace CastIt
+{
+	class FanoutBuffer;
+	class Mp4Layout;
+	class TokenBucket;
+	struct ConnectionMetrics;
+
+	// Inclusive byte range of a file, as used by the HTTP Range header
+	struct ByteRange
+	{
+		qint64 first = 0;
+		qint64 last = -1;
+
+		qint64 length() const { return last - first + 1; }
+	};
+
+	enum class RangeParseResult
+	{
+		NoRange, // Header absent or not a bytes range, serve the whole file
+		Satisfiable,
+		Unsatisfiable // Answer with 416
+	};
+
+	// Parses "bytes=a-b, c-, -n" against a file of fileSize bytes
+	RangeParseResult parseRangeHeader(QByteArrayView header, qint64 fileSize, QList<ByteRange>& ranges);
+
+	// A published file and how it should be served
+	struct MediaSource
+	{
+		QString filePath;
+		QByteArray mimeType;
+		std::shared_ptr<FanoutBuffer> fanout; // Set for files cast to several renderers at once
+		bool faststart = false; // Present MP4s with a trailing moov as if moov came first
+		qint64 paceBytesPerSecond = 0; // Per-connection send rate, 0 leaves the stream unpaced
+		qint64 burstBytes = 0; // Sent at full speed first, so renderers can fill their buffers
+	};
+
+	// Read-only, random-access view over the body of a (possibly multipart) range response.
+	// File bytes come from the shared ChunkCache, one chunk at a time, so memory does not grow
+	// with file size and hot regions are read from disk only once across all connections.
+	class MediaBody : public QIODevice
+	{
+		Q_OBJECT
+
+	public:
+		// Ranges address the virtual file described by layout when one is given, the real file otherwise
+		MediaBody(const MediaSource& source, const QList<ByteRange>& ranges,
+			std::shared_ptr<const Mp4Layout> layout = nullptr, QObject* parent = nullptr);
+		~MediaBody() override;
+
+		bool open(OpenMode mode) override;
+		void close() override;
+		bool isSequential() const override { return false; }
+		qint64 size() const override { return bodySize; }
+
+		qint64 fileSize() const { return totalFileSize; } // Size of the file as served
+		bool isMultipart() const { return ranges.size() > 1; }
+		QByteArray contentType() const; // Either the media type or multipart/byteranges
+		QByteArray contentRange() const; // Only meaningful for single-range responses
+
+		// Contiguous bytes available at pos() without copying; advance with seek()
+		QByteArrayView peekSpan(qint64 maxSize);
+
+	protected:
+		qint64 readData(char* data, qint64 maxSize) override;
+		qint64 writeData(const char* data, qint64 maxSize) override;
+
+	private:
+		struct Segment
+		{
+			qint64 bodyOffset = 0;
+			qint64 length = 0;
+			qint64 fileOffset = -1; // -1 means the bytes come from inlineData (framing or a patched moov)
+			QByteArray inlineData;
+			qint64 inlineOffset = 0;
+		};
+
+		QFile file;
+		QList<ByteRange> ranges;
+		QList<Segment> segments;
+		QByteArray mimeType;
+		QByteArray boundary;
+		qint64 bodySize = 0;
+		qint64 totalFileSize = 0;
+
+		quint64 cacheFileId = 0;
+		std::shared_ptr<FanoutBuffer> fanout;
+		int fanoutCursor = 0;
+		std::shared_ptr<const Mp4Layout> layout;
+		QByteArray chunk; // Chunk currently being served, shared with the cache
+		qint64 chunkIndex = -1;
+
+		void buildSegments();
+		void appendSegment(qint64 length, qint64 fileOffset, const QByteArray& inlineData, qint64 inlineOffset = 0);
+		void appendRange(const ByteRange& range);
+		const Segment* segmentAt(qint64 bodyPos) const;
+		QByteArrayView fileSpan(qint64 fileOffset, qint64 maxSize);
+	};
+
+	// Writes a response header followed by a MediaBody into a socket, only refilling the
+	// socket buffer when it drains (bytesWritten), so a slow client never buffers the file.
+	class MediaStream : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		// pacer belongs to the connection and outlives the stream; the global egress cap always applies
+		MediaStream(QTcpSocket* socket, MediaBody* body, TokenBucket* pacer = nullptr,
+			std::shared_ptr<ConnectionMetrics> metrics = nullptr, QObject* parent = nullptr);
+		~MediaStream() override;
+
+		// requestClock runs since the request was parsed and times the first body byte
+		void start(const QByteArray& header, const QElapsedTimer& requestClock = QElapsedTimer());
+
+	signals:
+		void finished();
+
+	private slots:
+		void pump();
+
+	private:
+		QPointer<QTcpSocket> socket;
+		MediaBody* body;
+		TokenBucket* pacer;
+		QTimer* resumeTimer; // Fires when enough tokens have accumulated for the next write
+		std::shared_ptr<ConnectionMetrics> metrics;
+		QElapsedTimer requestClock;
+		QElapsedTimer transferClock; // Started with the first body byte
+		bool done = false;
+	};
+
+	// Status and headers for a GET or HEAD of a local media file. body is opened and owned by the
+	// caller, and null for HEAD and errors. Connection handling is left to the caller.
+	struct MediaResponse
+	{
+		int statusCode = 200;
+		QList<QPair<QByteArray, QByteArray>> headers;
+		MediaBody* body = nullptr;
+
+		QByteArray headerBlock(bool keepAlive) const; // Status line and headers as sent on the wire
+	};
+
+	MediaResponse prepareMediaResponse(const MediaSource& source, bool headOnly, QByteArrayView rangeHeader);
+	MediaResponse errorResponse(int statusCode); // Empty-bodied error such as 404
+}
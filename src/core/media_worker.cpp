@@ -0,0 +1,42 @@
+#include "media_worker.h"
+#include "media_connection.h"
+#include <QTcpSocket>
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace CastIt
+{
+	MediaWorker::MediaWorker(MediaServer* server, QObject* parent) : QObject(parent), server(server)
+	{
+	}
+
+	void MediaWorker::adoptConnection(qintptr socketDescriptor)
+	{
+		// The socket is created here so its notifiers belong to this thread's event loop
+		QTcpSocket* socket = new QTcpSocket();
+		if (!socket->setSocketDescriptor(socketDescriptor))
+		{
+			qWarning() << "Failed to adopt media connection:" << socket->errorString();
+			delete socket;
+			// The socket never took ownership, so the accepted descriptor would leak
+#ifdef Q_OS_WIN
+			::closesocket(SOCKET(socketDescriptor));
+#else
+			::close(int(socketDescriptor));
+#endif
+			return;
+		}
+
+		connections.ref();
+		MediaConnection* connection = new MediaConnection(socket, server, this);
+		connect(connection, &QObject::destroyed, this, [this]()
+			{
+				connections.deref();
+			});
+	}
+}
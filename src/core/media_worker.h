@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInt>
+
+namespace CastIt
+{
+	class MediaServer;
+
+	// Lives on one of the MediaServer's I/O threads and owns the connections handed to it,
+	// so file reads and socket writes never run on the GUI thread
+	class MediaWorker : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		explicit MediaWorker(MediaServer* server, QObject* parent = nullptr);
+
+		int connectionCount() const { return connections.loadRelaxed(); } // Safe from any thread
+
+	public slots:
+		void adoptConnection(qintptr socketDescriptor);
+
+	private:
+		MediaServer* server;
+		QAtomicInt connections;
+	};
+}
@@ -0,0 +1,250 @@
+#include "mp4_layout.h"
+#include "chunk_cache.h"
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QWaitCondition>
+#include <QtEndian>
+#include <QDebug>
+
+namespace CastIt
+{
+	namespace
+	{
+		constexpr qint64 MaxMoovSize = 64 * 1024 * 1024; // Larger moovs are served as-is
+		constexpr int MaxTopLevelBoxes = 4096;
+		constexpr int MaxBoxDepth = 8;
+
+		constexpr quint32 fourCC(const char (&code)[5])
+		{
+			return (quint32(quint8(code[0])) << 24) | (quint32(quint8(code[1])) << 16) |
+				(quint32(quint8(code[2])) << 8) | quint32(quint8(code[3]));
+		}
+
+		// Boxes on the path from moov down to the chunk offset tables
+		bool isOffsetContainer(quint32 type)
+		{
+			return type == fourCC("trak") || type == fourCC("mdia") || type == fourCC("minf") || type == fourCC("stbl");
+		}
+
+		constexpr qsizetype MaxCachedBytes = 128 * 1024 * 1024; // Patched moovs kept, least recently used go first
+		constexpr qsizetype NegativeEntryCost = 64; // So files served as-is count against the budget too
+
+		using CachedLayout = std::shared_ptr<const Mp4Layout>;
+
+		QMutex layoutCacheMutex;
+		QWaitCondition layoutBuilt;
+		QCache<quint64, CachedLayout> layoutCache(MaxCachedBytes); // Negative results are cached as null
+		QSet<quint64> layoutsBuilding; // Keys some thread is scanning right now
+
+		qsizetype layoutCost(const CachedLayout& layout)
+		{
+			if (!layout)
+				return NegativeEntryCost;
+			qsizetype cost = sizeof(Mp4Layout);
+			for (const Mp4Layout::Piece& piece : layout->pieces())
+				cost += sizeof(Mp4Layout::Piece) + piece.data.size();
+			return cost;
+		}
+	}
+
+	std::shared_ptr<const Mp4Layout> Mp4Layout::forFile(const QString& filePath)
+	{
+		const quint64 key = ChunkCache::fileId(filePath);
+
+		{
+			// Concurrent first requests for one file wait for a single scan; requests for other
+			// files don't wait at all, the scan runs outside the lock
+			QMutexLocker locker(&layoutCacheMutex);
+			while (true)
+			{
+				if (const CachedLayout* cached = layoutCache.object(key))
+					return *cached;
+				if (!layoutsBuilding.contains(key))
+					break;
+				layoutBuilt.wait(&layoutCacheMutex);
+			}
+			layoutsBuilding.insert(key);
+		}
+
+		const CachedLayout layout = build(filePath);
+
+		QMutexLocker locker(&layoutCacheMutex);
+		layoutsBuilding.remove(key);
+		layoutCache.insert(key, new CachedLayout(layout), layoutCost(layout));
+		layoutBuilt.wakeAll();
+		return layout;
+	}
+
+	std::shared_ptr<const Mp4Layout> Mp4Layout::build(const QString& filePath)
+	{
+		QFile file(filePath);
+		QList<Box> boxes;
+		if (!file.open(QIODevice::ReadOnly) || !scanTopLevel(file, boxes))
+			return nullptr;
+
+		const Box* moov = nullptr;
+		const Box* mdat = nullptr;
+		for (const Box& box : boxes)
+		{
+			if (box.type == fourCC("moov") && !moov)
+				moov = &box;
+			else if (box.type == fourCC("mdat") && !mdat)
+				mdat = &box;
+			else if (box.type == fourCC("moof"))
+				return nullptr; // Fragmented files carry their own per-fragment indexes
+		}
+		if (boxes.isEmpty() || boxes.first().type != fourCC("ftyp") || !moov || !mdat)
+			return nullptr;
+		if (moov->offset < mdat->offset || moov->size > MaxMoovSize)
+			return nullptr;
+
+		QByteArray moovData;
+		if (file.seek(moov->offset))
+			moovData = file.read(moov->size);
+		if (moovData.size() != moov->size)
+			return nullptr;
+
+		// Everything from the first mdat up to the old moov position moves back by moov's size
+		if (!patchChunkOffsets(moovData.data(), moovData.size(), mdat->offset, moov->offset, moov->size, 0))
+		{
+			qDebug() << "Not relocating moov of" << filePath << ": chunk offsets would not fit";
+			return nullptr;
+		}
+
+		auto layout = std::make_shared<Mp4Layout>();
+		auto appendPiece = [&layout](qint64 length, qint64 fileOffset, const QByteArray& data)
+			{
+				if (length <= 0)
+					return;
+				Piece piece;
+				piece.virtualOffset = layout->virtualSize;
+				piece.length = length;
+				piece.fileOffset = fileOffset;
+				piece.data = data;
+				layout->layoutPieces.append(piece);
+				layout->virtualSize += length;
+			};
+
+		const qint64 moovEnd = moov->offset + moov->size;
+		appendPiece(mdat->offset, 0, QByteArray()); // ftyp and anything else ahead of the media data
+		appendPiece(moov->size, -1, moovData);
+		appendPiece(moov->offset - mdat->offset, mdat->offset, QByteArray());
+		appendPiece(file.size() - moovEnd, moovEnd, QByteArray());
+
+		qDebug() << "Serving" << filePath << "as faststart, moov of" << moov->size << "bytes moved to the front";
+		return layout;
+	}
+
+	bool Mp4Layout::scanTopLevel(QFile& file, QList<Box>& boxes)
+	{
+		const qint64 fileSize = file.size();
+		qint64 pos = 0;
+		while (pos + 8 <= fileSize)
+		{
+			uchar header[16];
+			if (!file.seek(pos) || file.read(reinterpret_cast<char*>(header), sizeof(header)) < 8)
+				return false;
+
+			Box box;
+			box.offset = pos;
+			box.type = qFromBigEndian<quint32>(header + 4);
+			quint64 size = qFromBigEndian<quint32>(header);
+			qint64 headerSize = 8;
+			if (size == 1)
+			{
+				if (pos + 16 > fileSize)
+					return false;
+				size = qFromBigEndian<quint64>(header + 8);
+				headerSize = 16;
+			}
+			else if (size == 0)
+			{
+				size = quint64(fileSize - pos); // Box runs to the end of the file
+			}
+
+			if (size < quint64(headerSize) || size > quint64(fileSize - pos))
+				return false;
+			box.size = qint64(size);
+			boxes.append(box);
+			if (boxes.size() > MaxTopLevelBoxes)
+				return false;
+			pos += box.size;
+		}
+		return true;
+	}
+
+	bool Mp4Layout::patchChunkOffsets(char* data, qint64 size, qint64 shiftFrom, qint64 shiftTo, qint64 delta, int depth)
+	{
+		if (depth > MaxBoxDepth)
+			return false;
+
+		// At depth 0 data is the moov box itself, below that it is a container's payload
+		qint64 pos = depth == 0 ? 8 : 0;
+		if (depth == 0 && qFromBigEndian<quint32>(data) == 1)
+			pos = 16;
+
+		while (pos + 8 <= size)
+		{
+			uchar* box = reinterpret_cast<uchar*>(data + pos);
+			const quint32 type = qFromBigEndian<quint32>(box + 4);
+			quint64 boxSize = qFromBigEndian<quint32>(box);
+			qint64 headerSize = 8;
+			if (boxSize == 1)
+			{
+				if (pos + 16 > size)
+					return false;
+				boxSize = qFromBigEndian<quint64>(box + 8);
+				headerSize = 16;
+			}
+			else if (boxSize == 0)
+			{
+				boxSize = quint64(size - pos);
+			}
+			if (boxSize < quint64(headerSize) || boxSize > quint64(size - pos))
+				return false;
+
+			uchar* payload = box + headerSize;
+			const qint64 payloadSize = qint64(boxSize) - headerSize;
+
+			if (isOffsetContainer(type))
+			{
+				if (!patchChunkOffsets(reinterpret_cast<char*>(payload), payloadSize, shiftFrom, shiftTo, delta, depth + 1))
+					return false;
+			}
+			else if (type == fourCC("stco") || type == fourCC("co64"))
+			{
+				// Full box: version and flags, entry count, then 32- or 64-bit offsets
+				const qint64 entrySize = type == fourCC("stco") ? 4 : 8;
+				if (payloadSize < 8)
+					return false;
+				const quint32 count = qFromBigEndian<quint32>(payload + 4);
+				if (qint64(count) * entrySize > payloadSize - 8)
+					return false;
+
+				uchar* entry = payload + 8;
+				for (quint32 i = 0; i < count; ++i, entry += entrySize)
+				{
+					quint64 offset = entrySize == 4 ? qFromBigEndian<quint32>(entry) : qFromBigEndian<quint64>(entry);
+					if (qint64(offset) < shiftFrom || qint64(offset) >= shiftTo)
+						continue;
+					offset += quint64(delta);
+					if (entrySize == 4)
+					{
+						// Growing stco into co64 would change moov's size again; give up instead
+						if (offset > 0xFFFFFFFFull)
+							return false;
+						qToBigEndian<quint32>(quint32(offset), entry);
+					}
+					else
+					{
+						qToBigEndian<quint64>(offset, entry);
+					}
+				}
+			}
+			pos += qint64(boxSize);
+		}
+		return true;
+	}
+}
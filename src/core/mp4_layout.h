@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QFile>
+#include <memory>
+
+namespace CastIt
+{
+	// Top-level box layout of an MP4 whose moov box trails its media data, presented as a
+	// virtual "faststart" file: moov first, with stco/co64 chunk offsets patched to match.
+	// The file on disk is never touched; the virtual file is a list of pieces that are either
+	// ranges of the real file or the patched moov held in memory.
+	class Mp4Layout
+	{
+	public:
+		struct Piece
+		{
+			qint64 virtualOffset = 0;
+			qint64 length = 0;
+			qint64 fileOffset = -1; // -1 means the bytes come from data
+			QByteArray data;
+		};
+
+		// Cached per path, size and mtime, least recently used dropped past a byte budget. Null when
+		// the file isn't an MP4, is fragmented, already has moov up front, or can't be relocated
+		// safely; serve it as-is then.
+		static std::shared_ptr<const Mp4Layout> forFile(const QString& filePath);
+
+		qint64 size() const { return virtualSize; }
+		const QList<Piece>& pieces() const { return layoutPieces; }
+
+	private:
+		struct Box
+		{
+			quint32 type = 0;
+			qint64 offset = 0;
+			qint64 size = 0;
+		};
+
+		qint64 virtualSize = 0;
+		QList<Piece> layoutPieces;
+
+		static std::shared_ptr<const Mp4Layout> build(const QString& filePath);
+		static bool scanTopLevel(QFile& file, QList<Box>& boxes);
+		static bool patchChunkOffsets(char* data, qint64 size, qint64 shiftFrom, qint64 shiftTo, qint64 delta, int depth);
+	};
+}
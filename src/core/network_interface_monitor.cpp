@@ -0,0 +1,219 @@
+#include "network_interface_monitor.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QReadLocker>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QWriteLocker>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace CastIt
+{
+	NetworkInterfaceMonitor* NetworkInterfaceMonitor::instance()
+	{
+		// Parented to the application so it is torn down with the event loop, not after it
+		static NetworkInterfaceMonitor* monitor = new NetworkInterfaceMonitor(QCoreApplication::instance());
+		return monitor;
+	}
+
+	NetworkInterfaceMonitor::NetworkInterfaceMonitor(QObject* parent) : QObject(parent),
+		settleTimer(new QTimer(this)),
+		pollTimer(new QTimer(this))
+	{
+		settleTimer->setSingleShot(true);
+		settleTimer->setInterval(SettleMs);
+		connect(settleTimer, &QTimer::timeout, this, &NetworkInterfaceMonitor::refresh);
+		connect(pollTimer, &QTimer::timeout, this, &NetworkInterfaceMonitor::refresh);
+
+		refresh();
+		if (!openNetlink())
+			pollTimer->start(PollIntervalMs);
+	}
+
+	NetworkInterfaceMonitor::~NetworkInterfaceMonitor()
+	{
+		delete notifier; // Before the descriptor it watches goes away
+#ifdef Q_OS_LINUX
+		if (netlinkSocket >= 0)
+			::close(netlinkSocket);
+#endif
+	}
+
+	bool NetworkInterfaceMonitor::openNetlink()
+	{
+#ifdef Q_OS_LINUX
+		netlinkSocket = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+		if (netlinkSocket < 0)
+			return false;
+
+		sockaddr_nl address = {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+		if (::bind(netlinkSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+		{
+			qWarning() << "NetworkInterfaceMonitor: netlink unavailable, polling interfaces instead";
+			::close(netlinkSocket);
+			netlinkSocket = -1;
+			return false;
+		}
+
+		notifier = new QSocketNotifier(netlinkSocket, QSocketNotifier::Read, this);
+		connect(notifier, &QSocketNotifier::activated, this, &NetworkInterfaceMonitor::readNetlink);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void NetworkInterfaceMonitor::readNetlink()
+	{
+#ifdef Q_OS_LINUX
+		alignas(nlmsghdr) char buffer[8192];
+		bool relevant = false;
+		while (true)
+		{
+			const ssize_t received = ::recv(netlinkSocket, buffer, sizeof(buffer), MSG_DONTWAIT);
+			if (received <= 0)
+				break;
+
+			int remaining = int(received);
+			for (const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(buffer); NLMSG_OK(header, remaining);
+				header = NLMSG_NEXT(header, remaining))
+			{
+				switch (header->nlmsg_type)
+				{
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					relevant = true;
+					break;
+				case NLMSG_OVERRUN:
+					relevant = true; // Events were lost, the refresh picks up whatever they said
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		if (relevant)
+			settleTimer->start();
+#endif
+	}
+
+	void NetworkInterfaceMonitor::refresh()
+	{
+		const QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
+		QSet<QHostAddress> addresses;
+		QHostAddress primary;
+		QStringList newSignature;
+		for (const QNetworkInterface& interface : interfaces)
+		{
+			QStringList entries;
+			for (const QNetworkAddressEntry& entry : interface.addressEntries())
+			{
+				addresses.insert(entry.ip());
+				entries.append(entry.ip().toString());
+			}
+			std::sort(entries.begin(), entries.end());
+			newSignature.append(QString("%1/%2/%3").arg(interface.index()).arg(int(interface.flags())).arg(entries.join(',')));
+
+			const bool usable = (interface.flags() & QNetworkInterface::IsUp) &&
+				(interface.flags() & QNetworkInterface::IsRunning) &&
+				!(interface.flags() & QNetworkInterface::IsLoopBack);
+			if (!usable || !primary.isNull())
+				continue;
+			for (const QNetworkAddressEntry& entry : interface.addressEntries())
+			{
+				if (entry.ip().protocol() == QAbstractSocket::IPv4Protocol)
+				{
+					primary = entry.ip();
+					break;
+				}
+			}
+		}
+
+		{
+			QWriteLocker locker(&lock);
+			if (populated && newSignature == signature)
+				return;
+			const bool first = !populated;
+			cachedInterfaces = interfaces;
+			localAddresses = addresses;
+			primaryAddress = primary;
+			signature = newSignature;
+			populated = true;
+			if (first)
+				return;
+		}
+		qDebug() << "Network interfaces changed, primary IPv4 now" << primary.toString();
+		emit interfacesChanged();
+	}
+
+	QList<QNetworkInterface> NetworkInterfaceMonitor::interfaces() const
+	{
+		QReadLocker locker(&lock);
+		return cachedInterfaces;
+	}
+
+	bool NetworkInterfaceMonitor::isLocalAddress(const QHostAddress& address) const
+	{
+		QReadLocker locker(&lock);
+		return localAddresses.contains(address);
+	}
+
+	QHostAddress NetworkInterfaceMonitor::primaryIPv4() const
+	{
+		QReadLocker locker(&lock);
+		return primaryAddress;
+	}
+
+	QHostAddress NetworkInterfaceMonitor::localAddressFor(const QHostAddress& peer, int interfaceIndex) const
+	{
+		QHostAddress target = peer;
+		bool mapped = false;
+		const quint32 ipv4 = peer.toIPv4Address(&mapped);
+		if (mapped)
+			target = QHostAddress(ipv4);
+		if (interfaceIndex == 0 && !target.scopeId().isEmpty())
+			interfaceIndex = QNetworkInterface::interfaceIndexFromName(target.scopeId());
+
+		QReadLocker locker(&lock);
+		const QNetworkInterface* heardOn = nullptr;
+		for (const QNetworkInterface& interface : cachedInterfaces)
+		{
+			if (interface.flags() & QNetworkInterface::IsLoopBack)
+				continue;
+			if (interface.index() == interfaceIndex)
+				heardOn = &interface;
+			for (const QNetworkAddressEntry& entry : interface.addressEntries())
+			{
+				if (!target.isNull() && entry.ip().protocol() == target.protocol() && entry.prefixLength() > 0 &&
+					target.isInSubnet(entry.ip(), entry.prefixLength()))
+					return entry.ip();
+			}
+		}
+
+		if (heardOn)
+		{
+			QHostAddress fallback;
+			for (const QNetworkAddressEntry& entry : heardOn->addressEntries())
+			{
+				if (entry.ip().protocol() == QAbstractSocket::IPv4Protocol)
+					return entry.ip();
+				if (fallback.isNull() && !entry.ip().isLinkLocal())
+					fallback = entry.ip();
+			}
+			if (!fallback.isNull())
+				return fallback;
+		}
+		return primaryAddress;
+	}
+}
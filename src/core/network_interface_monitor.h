@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QObject>
+#include <QHostAddress>
+#include <QList>
+#include <QNetworkInterface>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QStringList>
+
+class QSocketNotifier;
+class QTimer;
+
+namespace CastIt
+{
+	// Process-wide cache of the host's network interfaces and addresses, so hot paths (every
+	// received datagram, every published URL) don't enumerate interfaces through the OS. On Linux
+	// the cache follows rtnetlink link/address events; elsewhere, or if netlink is unavailable, it
+	// is re-read every PollIntervalMs. The accessors are thread-safe.
+	class NetworkInterfaceMonitor : public QObject
+	{
+		Q_OBJECT
+
+	public:
+		static constexpr int PollIntervalMs = 10000;
+		static constexpr int SettleMs = 250; // Address changes come in bursts, refresh once they settle
+
+		static NetworkInterfaceMonitor* instance(); // Created on first use, lives until the application quits
+		~NetworkInterfaceMonitor() override;
+
+		QList<QNetworkInterface> interfaces() const;
+		bool isLocalAddress(const QHostAddress& address) const;
+		// First IPv4 address of an interface that is up, running and not loopback; null if none
+		QHostAddress primaryIPv4() const;
+		// Our address a peer can reach: one on the peer's subnet, else one on the interface the
+		// peer was heard on (IPv4 preferred), else primaryIPv4()
+		QHostAddress localAddressFor(const QHostAddress& peer, int interfaceIndex = 0) const;
+
+	signals:
+		void interfacesChanged(); // Emitted on the monitor's thread after the cache was updated
+
+	public slots:
+		void refresh(); // Re-reads the interfaces now
+
+	private slots:
+		void readNetlink();
+
+	private:
+		explicit NetworkInterfaceMonitor(QObject* parent = nullptr);
+
+		mutable QReadWriteLock lock;
+		QList<QNetworkInterface> cachedInterfaces;
+		QSet<QHostAddress> localAddresses;
+		QHostAddress primaryAddress;
+		QStringList signature; // What counts as a change: index, flags and addresses per interface
+		bool populated = false;
+
+		QTimer* settleTimer;
+		QTimer* pollTimer;
+		QSocketNotifier* notifier = nullptr;
+		int netlinkSocket = -1;
+
+		bool openNetlink();
+	};
+}
@@ -0,0 +1,197 @@
+#include "ssdp_message.h"
+#include <limits>
+
+namespace CastIt
+{
+	namespace
+	{
+		bool equalsIgnoreCase(QByteArrayView a, QByteArrayView b)
+		{
+			return a.size() == b.size() && qstrnicmp(a.data(), a.size(), b.data(), b.size()) == 0;
+		}
+
+		bool startsWithIgnoreCase(QByteArrayView text, QByteArrayView prefix)
+		{
+			return text.size() >= prefix.size() && equalsIgnoreCase(text.first(prefix.size()), prefix);
+		}
+
+		bool isSpace(char c)
+		{
+			return c == ' ' || c == '\t';
+		}
+
+		QByteArrayView trimmed(QByteArrayView text)
+		{
+			qsizetype begin = 0;
+			qsizetype end = text.size();
+			while (begin < end && isSpace(text[begin]))
+				++begin;
+			while (end > begin && isSpace(text[end - 1]))
+				--end;
+			return text.sliced(begin, end - begin);
+		}
+
+		// Leading decimal digits of text, -1 if there are none or they overflow
+		qint64 leadingNumber(QByteArrayView text)
+		{
+			qint64 value = -1;
+			for (char c : text)
+			{
+				if (c < '0' || c > '9')
+					break;
+				const int digit = c - '0';
+				if (value > (std::numeric_limits<qint64>::max() - digit) / 10)
+					return -1;
+				value = (value < 0 ? 0 : value * 10) + digit;
+			}
+			return value;
+		}
+
+		// Next line from pos, without its CRLF (or bare LF, which some renderers send)
+		bool nextLine(QByteArrayView datagram, qsizetype& pos, QByteArrayView& line)
+		{
+			if (pos >= datagram.size())
+				return false;
+			qsizetype end = datagram.indexOf('\n', pos);
+			const qsizetype next = end < 0 ? datagram.size() : end + 1;
+			if (end < 0)
+				end = datagram.size();
+			if (end > pos && datagram[end - 1] == '\r')
+				--end;
+			line = datagram.sliced(pos, end - pos);
+			pos = next;
+			return true;
+		}
+
+		// max-age out of a CACHE-CONTROL list such as "no-cache, max-age = 1800"
+		int maxAgeDirective(QByteArrayView value)
+		{
+			qsizetype from = 0;
+			while (from < value.size())
+			{
+				qsizetype comma = value.indexOf(',', from);
+				if (comma < 0)
+					comma = value.size();
+				const QByteArrayView directive = trimmed(value.sliced(from, comma - from));
+				from = comma + 1;
+				if (!startsWithIgnoreCase(directive, "max-age"))
+					continue;
+				const QByteArrayView rest = trimmed(directive.sliced(7));
+				if (rest.isEmpty() || rest[0] != '=')
+					continue;
+				const qint64 seconds = leadingNumber(trimmed(rest.sliced(1)));
+				if (seconds >= 0)
+					return int(qMin<qint64>(seconds, std::numeric_limits<int>::max()));
+			}
+			return -1;
+		}
+	}
+
+	bool SsdpMessage::parse(QByteArrayView datagram)
+	{
+		*this = SsdpMessage();
+
+		qsizetype pos = 0;
+		QByteArrayView line;
+		if (!nextLine(datagram, pos, line))
+			return reject("Empty datagram");
+		if (!parseStartLine(line))
+			return false;
+
+		while (nextLine(datagram, pos, line) && !line.isEmpty())
+			parseHeaderLine(line);
+		return true;
+	}
+
+	bool SsdpMessage::parseStartLine(QByteArrayView line)
+	{
+		// "HTTP/1.1 200 OK", "NOTIFY * HTTP/1.1" or "M-SEARCH * HTTP/1.1"
+		if (line.startsWith("HTTP/1."))
+		{
+			if (line.size() < 12 || line[8] != ' ')
+				return reject("Malformed status line");
+			const qint64 code = leadingNumber(line.sliced(9, 3));
+			if (code < 100 || code > 999)
+				return reject("Malformed status code");
+			messageKind = Kind::Response;
+			status = int(code);
+			return true;
+		}
+		if (line.startsWith("NOTIFY "))
+		{
+			messageKind = Kind::Notify;
+			return true;
+		}
+		if (line.startsWith("M-SEARCH "))
+		{
+			messageKind = Kind::Search;
+			return true;
+		}
+		return reject("Not an SSDP message");
+	}
+
+	void SsdpMessage::parseHeaderLine(QByteArrayView line)
+	{
+		const qsizetype colon = line.indexOf(':');
+		if (colon <= 0)
+			return; // Tolerated: renderers send all sorts of junk, the headers we need are what matters
+		const QByteArrayView name = trimmed(line.first(colon));
+		const QByteArrayView value = trimmed(line.sliced(colon + 1));
+
+		// Dispatch on the name length first, so most headers cost one comparison at most
+		switch (name.size())
+		{
+		case 2:
+			if (equalsIgnoreCase(name, "ST") || equalsIgnoreCase(name, "NT"))
+				searchTarget = value;
+			break;
+		case 3:
+			if (equalsIgnoreCase(name, "USN"))
+				uniqueServiceName = value;
+			else if (equalsIgnoreCase(name, "NTS"))
+			{
+				if (equalsIgnoreCase(value, "ssdp:alive"))
+					nts = Notification::Alive;
+				else if (equalsIgnoreCase(value, "ssdp:byebye"))
+					nts = Notification::ByeBye;
+				else if (equalsIgnoreCase(value, "ssdp:update"))
+					nts = Notification::Update;
+			}
+			break;
+		case 6:
+			if (equalsIgnoreCase(name, "SERVER"))
+				serverString = value;
+			break;
+		case 8:
+			if (equalsIgnoreCase(name, "LOCATION"))
+				locationUrl = value;
+			break;
+		case 13:
+			if (equalsIgnoreCase(name, "CACHE-CONTROL"))
+				cacheMaxAge = maxAgeDirective(value);
+			break;
+		case 15:
+			if (equalsIgnoreCase(name, "BOOTID.UPNP.ORG"))
+				boot = leadingNumber(value);
+			break;
+		case 19:
+			if (equalsIgnoreCase(name, "NEXTBOOTID.UPNP.ORG"))
+				nextBoot = leadingNumber(value);
+			break;
+		default:
+			break;
+		}
+	}
+
+	QByteArrayView SsdpMessage::deviceUuid() const
+	{
+		const qsizetype separator = uniqueServiceName.indexOf("::");
+		return separator < 0 ? uniqueServiceName : uniqueServiceName.first(separator);
+	}
+
+	bool SsdpMessage::reject(const char* reason)
+	{
+		error = reason;
+		return false;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QtGlobal>
+
+namespace CastIt
+{
+	// View over one SSDP datagram: an M-SEARCH response, a NOTIFY or an M-SEARCH. parse() walks the
+	// head once and keeps only the headers discovery acts on, as views into the datagram, so it
+	// never allocates. The datagram must outlive the message.
+	class SsdpMessage
+	{
+	public:
+		enum class Kind
+		{
+			Response, // HTTP/1.1 200 OK to our M-SEARCH
+			Notify,
+			Search
+		};
+
+		enum class Notification
+		{
+			None, // Not a NOTIFY, or an NTS we don't know
+			Alive,
+			ByeBye,
+			Update
+		};
+
+		// False for anything that is not an SSDP start line; nothing of a rejected datagram may be used
+		bool parse(QByteArrayView datagram);
+		const char* errorString() const { return error; }
+
+		Kind kind() const { return messageKind; }
+		int statusCode() const { return status; } // Responses only, 0 otherwise
+		Notification notification() const { return nts; }
+
+		QByteArrayView target() const { return searchTarget; } // ST of a response or search, NT of a NOTIFY
+		QByteArrayView usn() const { return uniqueServiceName; }
+		QByteArrayView location() const { return locationUrl; }
+		QByteArrayView server() const { return serverString; }
+		int maxAge() const { return cacheMaxAge; } // CACHE-CONTROL max-age in seconds, -1 if absent
+		qint64 bootId() const { return boot; } // BOOTID.UPNP.ORG, -1 if absent
+		qint64 nextBootId() const { return nextBoot; } // NEXTBOOTID.UPNP.ORG of ssdp:update, -1 if absent
+
+		// "uuid:<id>" of the USN, without the "::<type>" suffix; equal for all services of a device
+		QByteArrayView deviceUuid() const;
+
+	private:
+		Kind messageKind = Kind::Response;
+		int status = 0;
+		Notification nts = Notification::None;
+		QByteArrayView searchTarget;
+		QByteArrayView uniqueServiceName;
+		QByteArrayView locationUrl;
+		QByteArrayView serverString;
+		int cacheMaxAge = -1;
+		qint64 boot = -1;
+		qint64 nextBoot = -1;
+		const char* error = nullptr;
+
+		bool parseStartLine(QByteArrayView line);
+		void parseHeaderLine(QByteArrayView line);
+		bool reject(const char* reason); // Always returns false
+	};
+}
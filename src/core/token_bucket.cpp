@@ -0,0 +1,93 @@
+#include "token_bucket.h"
+#include <QMutexLocker>
+#include <cmath>
+#include <limits>
+
+namespace CastIt
+{
+	void TokenBucket::configure(qint64 bytesPerSecond, qint64 burstBytes)
+	{
+		bytesPerSecond = qMax<qint64>(0, bytesPerSecond);
+		burstBytes = qMax<qint64>(0, burstBytes);
+		if (bytesPerSecond == rate && burstBytes == capacity)
+			return;
+
+		rate = bytesPerSecond;
+		capacity = burstBytes;
+		tokens = double(capacity);
+		clock.start();
+	}
+
+	qint64 TokenBucket::available()
+	{
+		if (!isLimited())
+			return std::numeric_limits<qint64>::max();
+		refill();
+		return qint64(tokens);
+	}
+
+	void TokenBucket::consume(qint64 bytes)
+	{
+		if (!isLimited())
+			return;
+		refill();
+		tokens = qMax(0.0, tokens - double(bytes));
+	}
+
+	int TokenBucket::msUntilAvailable(qint64 bytes)
+	{
+		if (!isLimited())
+			return 0;
+		refill();
+		// A request larger than the burst would never fit, wait for a full bucket instead
+		const double missing = double(qMin(bytes, qMax<qint64>(capacity, 1))) - tokens;
+		if (missing <= 0.0)
+			return 0;
+		return qMax(1, int(std::ceil(missing * 1000.0 / double(rate))));
+	}
+
+	void TokenBucket::refill()
+	{
+		const qint64 elapsedNs = clock.nsecsElapsed();
+		clock.start();
+		tokens = qMin(double(capacity), tokens + double(rate) * double(elapsedNs) / 1e9);
+	}
+
+	EgressLimiter& EgressLimiter::instance()
+	{
+		static EgressLimiter limiter;
+		return limiter;
+	}
+
+	void EgressLimiter::setLimit(qint64 bytesPerSecond)
+	{
+		// A quarter second of burst keeps writes large without letting the cap be overshot noticeably
+		QMutexLocker locker(&mutex);
+		bucket.configure(bytesPerSecond, qMax<qint64>(bytesPerSecond / 4, 64 * 1024));
+	}
+
+	qint64 EgressLimiter::limit() const
+	{
+		QMutexLocker locker(&mutex);
+		return bucket.bytesPerSecond();
+	}
+
+	qint64 EgressLimiter::take(qint64 wanted, qint64 minimum)
+	{
+		QMutexLocker locker(&mutex);
+		if (!bucket.isLimited())
+			return wanted;
+
+		const qint64 granted = qMin(wanted, bucket.available());
+		if (granted < minimum)
+			return 0;
+		bucket.consume(granted);
+		return granted;
+	}
+
+	int EgressLimiter::msUntilAvailable(qint64 bytes)
+	{
+		QMutexLocker locker(&mutex);
+		return bucket.msUntilAvailable(bytes);
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QtGlobal>
+
+namespace CastIt
+{
+	// Classic token bucket over bytes: refills at a fixed rate up to a burst capacity. Not
+	// thread-safe, each media connection owns one. A rate of 0 means unlimited.
+	class TokenBucket
+	{
+	public:
+		// Starts full. Reconfiguring with the same values keeps the current fill level.
+		void configure(qint64 bytesPerSecond, qint64 burstBytes);
+		bool isLimited() const { return rate > 0; }
+		qint64 bytesPerSecond() const { return rate; }
+
+		qint64 available();
+		void consume(qint64 bytes);
+		int msUntilAvailable(qint64 bytes); // 0 if already available
+
+	private:
+		qint64 rate = 0;
+		qint64 capacity = 0;
+		double tokens = 0.0;
+		QElapsedTimer clock;
+
+		void refill();
+	};
+
+	// Process-wide egress cap shared by every media connection on every I/O thread
+	class EgressLimiter
+	{
+	public:
+		static EgressLimiter& instance();
+
+		void setLimit(qint64 bytesPerSecond); // 0 removes the cap
+		qint64 limit() const;
+
+		// Up to wanted bytes, or 0 when fewer than minimum are available
+		qint64 take(qint64 wanted, qint64 minimum);
+		int msUntilAvailable(qint64 bytes);
+
+	private:
+		EgressLimiter() = default;
+
+		mutable QMutex mutex;
+		TokenBucket bucket;
+	};
+}
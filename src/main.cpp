@@ -4,6 +4,7 @@
 int main(int argc, char* argv[])
 {
 	QApplication app(argc, argv);
+	app.setApplicationName("CastIt"); // Names the cache directory that holds the media probe index
 	CastIt::MainWindow window;
 	window.show();
 	return app.exec();
@@ -1,5 +1,6 @@
 #include "main_window.h"
 #include "ui_main_window.h"
+#include "core/media_probe.h"
 #include <QDebug>
 #include <QFileDialog>
 
@@ -10,6 +11,14 @@ namespace CastIt
 		ui->setupUi(this);
 		setWindowTitle("CastIt Media Casting App");
 		resize(500, 400);
+
+		// Devices already known (e.g. from another window) first, then only the deltas
+		DeviceRegistry* registry = DeviceRegistry::instance();
+		for (const DevicePtr& device : registry->snapshot())
+			showDevice(device);
+		connect(registry, &DeviceRegistry::devicesChanged, this, &MainWindow::onDevicesChanged);
+		registry->restore(); // Last run's devices, listed as unverified until discovery confirms them
+
 		initializeDiscovery();
 		dlnaDiscovery = new DlnaDiscovery(this);
 		dlnaDiscovery->startDiscovery(); // Start DLNA discovery
@@ -21,8 +30,6 @@ namespace CastIt
 		connect(ui->pauseButton, &QPushButton::clicked, this, &MainWindow::onPauseButtonClicked);
 		connect(ui->stopButton, &QPushButton::clicked, this, &MainWindow::onStopButtonClicked);
 		connect(ui->deviceList, &QListWidget::itemSelectionChanged, this, &MainWindow::onDeviceSelectionChanged);
-		connect(dlnaDiscovery, &DlnaDiscovery::renderersUpdated, this, &MainWindow::onRenderersUpdated);
-		connect(dlnaDiscovery, &DlnaDiscovery::rendererUrlsUpdated, this, &MainWindow::onRendererUrlsUpdated);
 
 		castController = new CastController(this);
 		connect(castController, &CastController::castingStatus, this, [](const QString& status)
@@ -33,8 +40,6 @@ namespace CastIt
 			{
 				qDebug() << "Casting error:" << error;
 			});
-		connect(deviceDiscovery, &DeviceDiscovery::deviceIpsUpdated, this, &MainWindow::onDeviceIpsUpdated);
-
 	}
 
 	MainWindow::~MainWindow()
@@ -46,14 +51,37 @@ namespace CastIt
 	void MainWindow::initializeDiscovery()
 	{
 		deviceDiscovery = new DeviceDiscovery(this);
-		connect(deviceDiscovery, &DeviceDiscovery::devicesUpdated, this, &MainWindow::updateDeviceList);
 		deviceDiscovery->startDiscovery();
 	}
 
-	void MainWindow::updateDeviceList(const QStringList& devices)
+	void MainWindow::onDevicesChanged(const DeviceRegistry::Delta& delta)
 	{
-		ui->deviceList->clear(); // Clear existing items
-		ui->deviceList->addItems(devices); // Add new devices
+		// One repaint for the whole batch rather than one per row
+		ui->deviceList->setUpdatesEnabled(false);
+		for (const DevicePtr& device : delta.added)
+			showDevice(device);
+		for (const DevicePtr& device : delta.changed)
+			showDevice(device);
+		for (const QString& id : delta.removed)
+			delete deviceItems.take(id); // QListWidget drops deleted items by itself
+		ui->deviceList->setUpdatesEnabled(true);
+	}
+
+	void MainWindow::showDevice(const DevicePtr& device)
+	{
+		if (QListWidgetItem* item = deviceItems.value(device->id))
+		{
+			item->setText(device->displayName()); // Selection and position stay as they are
+			return;
+		}
+		QListWidgetItem* item = new QListWidgetItem(device->displayName(), ui->deviceList);
+		item->setData(Qt::UserRole, device->id);
+		deviceItems.insert(device->id, item);
+	}
+
+	DevicePtr MainWindow::deviceForItem(const QListWidgetItem* item) const
+	{
+		return item ? DeviceRegistry::instance()->device(item->data(Qt::UserRole).toString()) : DevicePtr();
 	}
 
 	void MainWindow::onSelectedMediaButtonClicked()
@@ -66,47 +94,74 @@ namespace CastIt
 		}
 	}
 
-	void MainWindow::onRenderersUpdated(const QStringList& renderers)
+	void MainWindow::onPlayButtonClicked()
 	{
-		for (const QString& renderer : renderers)
+		// Renderers that told us their formats and lack this one are skipped up front, rather than
+		// failing after SetAVTransportURI. The probe is cached, so this costs nothing on repeat.
+		const QByteArray mimeType = selectedMediaPath.isEmpty() ? QByteArray() : MediaProbe::instance().probe(selectedMediaPath).mimeType;
+
+		// Several DLNA renderers selected: one fan-out cast instead of a cast per device
+		QStringList dlnaControlUrls;
+		const QList<QListWidgetItem*> selectedItems = ui->deviceList->selectedItems();
+		for (const QListWidgetItem* item : selectedItems)
 		{
-			ui->deviceList->addItem("DLNA: " + renderer);
+			const DevicePtr device = deviceForItem(item);
+			if (!device || device->kind != DeviceInfo::Kind::Dlna || device->controlUrl.isEmpty())
+				continue;
+			if (device->acceptsFormat(mimeType))
+				dlnaControlUrls.append(device->controlUrl);
+			else
+				qDebug() << device->name << "does not accept" << mimeType << ", skipped";
+		}
+		if (selectedItems.size() > 1 && !selectedMediaPath.isEmpty())
+		{
+			// The format filter may leave one renderer, or none, of a multi-selection; the
+			// current item could be one that was just skipped, so it is not used here
+			if (dlnaControlUrls.isEmpty())
+			{
+				qDebug() << "No selected DLNA renderer accepts" << mimeType;
+				return;
+			}
+			selectedDeviceType = "DLNA";
+			if (dlnaControlUrls.size() == 1)
+				dlnaController->castMedia(dlnaControlUrls.first(), selectedMediaPath);
+			else
+				dlnaController->castMediaToRenderers(dlnaControlUrls, selectedMediaPath);
+			return;
 		}
-	}
 
-	void MainWindow::onRendererUrlsUpdated(const QMap<QString, QString>& urls)
-	{
-		dlnaUrls = urls;
-	}
-	
-	void MainWindow::onPlayButtonClicked()
-	{
-		QString selectedDevice = ui->deviceList->currentItem() ? ui->deviceList->currentItem()->text() : "None";
-		if (selectedMediaPath.isEmpty() || selectedDevice == "None")
+		const DevicePtr device = deviceForItem(ui->deviceList->currentItem());
+		if (selectedMediaPath.isEmpty() || !device)
 		{
 			qDebug() << "No media or device selected";
 			return;
 		}
 
-		QHostAddress ip = deviceIps.value(selectedDevice);
-		if (ip.isNull())
+		if (device->address.isNull())
 		{
 			qDebug() << "No IP for selected device";
 			return;
 		}
-		if (selectedDevice.startsWith("DLNA: "))
+		switch (device->kind)
 		{
+		case DeviceInfo::Kind::Dlna:
+			if (!device->acceptsFormat(mimeType))
+			{
+				qDebug() << device->name << "does not accept" << mimeType << "; it plays" << device->formats;
+				return;
+			}
 			selectedDeviceType = "DLNA";
-			QString rendererName = selectedDevice.mid(6); // Remove "DLNA: " prefix
-			QString controlUrl = dlnaUrls[rendererName];
-			dlnaController->castMedia(controlUrl, selectedMediaPath);
+			dlnaController->castMedia(device->controlUrl, selectedMediaPath);
+			break;
+		case DeviceInfo::Kind::Cast:
+			selectedDeviceType = "Chromecast";
+			castController->startMediaServer(selectedMediaPath, device->address, device->interfaceIndex);
+			castController->castMedia(device->address, castController->getLocalUrl()); // Local URL from server
+			break;
+		case DeviceInfo::Kind::AirPlay:
+			qDebug() << "Casting to AirPlay devices is not supported yet:" << device->name;
+			break;
 		}
-		else if (selectedDevice.startsWith("Chromecast: "))
-		{
-			castController->startMediaServer(selectedMediaPath);
-			castController->castMedia(ip, castController->getLocalUrl()); // Local URL from server
-		}
-
 	}
 
 	void MainWindow::onPauseButtonClicked()
@@ -119,6 +174,18 @@ namespace CastIt
 	{
 		QString selectedDevice = ui->deviceList->currentItem() ? ui->deviceList->currentItem()->text() : "None";
 		qDebug() << "Stop requested for device: " << selectedDevice;
+
+		// Ends the session of each selected renderer only, the others keep playing
+		for (const QListWidgetItem* item : ui->deviceList->selectedItems())
+		{
+			const DevicePtr device = deviceForItem(item);
+			if (!device)
+				continue;
+			if (device->kind == DeviceInfo::Kind::Dlna && !device->controlUrl.isEmpty())
+				dlnaController->stop(device->controlUrl);
+			else if (device->kind == DeviceInfo::Kind::Cast)
+				castController->stop(device->address);
+		}
 	}
 
 	void MainWindow::onDeviceSelectionChanged()
@@ -126,9 +193,4 @@ namespace CastIt
 		QString selectedDevice = ui->deviceList->currentItem() ? ui->deviceList->currentItem()->text() : "None";
 		qDebug() << "Device selected: " << selectedDevice;
 	}
-
-	void MainWindow::onDeviceIpsUpdated(const QMap<QString, QHostAddress>& ips)
-	{
-		deviceIps = ips;
-	}
-}
\ No newline at end of file
+}
@@ -1,10 +1,14 @@
 #pragma once
 #include <QMainWindow>
 #include <QString>
+#include <QHash>
 #include "core/device_discovery.h"
 #include <core/cast_controller.h>
 #include <core/dlna_discovery.h>
 #include <core/dlna_controller.h>
+#include <core/device_registry.h>
+
+class QListWidgetItem;
 
 namespace Ui
 {
@@ -23,13 +27,12 @@ namespace CastIt
 
 		// Slots are functions that can be called in response to signals
 	private slots:
-		void updateDeviceList(const QStringList& devices); // Slot for device updates
+		void onDevicesChanged(const CastIt::DeviceRegistry::Delta& delta); // Registry deltas, one list item per device id
 		void onSelectedMediaButtonClicked(); // Handle media button selection
 		void onPlayButtonClicked(); // Handle play button
 		void onPauseButtonClicked(); // Handle pause button
 		void onStopButtonClicked(); // Handle stop button
 		void onDeviceSelectionChanged(); // Handle device selection
-		void onDeviceIpsUpdated(const QMap<QString, QHostAddress>& ips); // Handle device IP updates
 
 	private:
 		// Setting pointers for the fields allows us to decuple the lifetime of the UI and discovery objects from the MainWindow
@@ -37,16 +40,13 @@ namespace CastIt
 		DeviceDiscovery* deviceDiscovery; // Pointer to the device discovery object
 		QString selectedMediaPath; // Path to the selected media file
 		CastController* castController; // Pointer to the cast controller
-		QMap<QString, QHostAddress> deviceIps; // Map of device names to IP addresses
+		QHash<QString, QListWidgetItem*> deviceItems; // Device id to its list entry
 		void initializeDiscovery();
+		void showDevice(const DevicePtr& device); // Adds its list entry, or relabels the existing one
+		DevicePtr deviceForItem(const QListWidgetItem* item) const;
 
 		DlnaDiscovery* dlnaDiscovery; // Pointer to the DLNA discovery object
 		DlnaController* dlnaController; // Pointer to the DLNA controller object
-		QMap<QString, QString> dlnaUrls;
 		QString selectedDeviceType;
-
-		void onRenderersUpdated(const QStringList& renderers); // Handle DLNA renderer updates
-		void onRendererUrlsUpdated(const QMap<QString, QString>& urls); // Handle DLNA renderer URLs
-
 	};
 }
@@ -0,0 +1,82 @@
+// Packs the refresh questions of a full network's worth of Cast devices and checks the packets
+// stay few and within the size every interface can carry.
+#include "core/mdns_query_coalescer.h"
+#include "core/mdns_query_scheduler.h"
+#include "core/mdns_record_cache.h"
+#include <QtEndian>
+#include <QtTest>
+
+using CastIt::MdnsQueryCoalescer;
+using CastIt::MdnsRecordCache;
+namespace Dns = CastIt::Dns;
+
+class TestMdnsQueryCoalescer : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void fiftyInstances();
+	void repeatWithinWindow();
+	void scheduledRepeatGoesOut();
+
+private:
+	static QList<MdnsQueryCoalescer::Question> questionsFor(int instances);
+};
+
+QList<MdnsQueryCoalescer::Question> TestMdnsQueryCoalescer::questionsFor(int instances)
+{
+	QList<MdnsQueryCoalescer::Question> questions;
+	for (int i = 0; i < instances; ++i)
+	{
+		const QByteArray instance = "CastIt Test " + QByteArray::number(i).rightJustified(2, '0') + "._googlecast._tcp.local";
+		const QByteArray host = "castit-test-" + QByteArray::number(i).rightJustified(2, '0') + ".local";
+		questions.append({ instance, Dns::SRV });
+		questions.append({ instance, Dns::TXT });
+		questions.append({ host, Dns::A });
+		questions.append({ host, Dns::AAAA });
+	}
+	return questions;
+}
+
+void TestMdnsQueryCoalescer::fiftyInstances()
+{
+	const QList<MdnsQueryCoalescer::Question> questions = questionsFor(50);
+	MdnsQueryCoalescer coalescer;
+	const MdnsRecordCache cache;
+	const QList<QByteArray> packets = coalescer.build(questions, cache, 0);
+
+	// 200 questions sharing "_googlecast._tcp.local" and "local" compress into two packets
+	QCOMPARE(packets.size(), 2);
+	int questionCount = 0;
+	for (const QByteArray& packet : packets)
+	{
+		QVERIFY(packet.size() > 12);
+		QVERIFY2(packet.size() <= MdnsQueryCoalescer::MaxPacketSize, qPrintable(QString::number(packet.size())));
+		QCOMPARE(qFromBigEndian<quint16>(packet.constData() + 6), quint16(0)); // Nothing cached to list
+		questionCount += qFromBigEndian<quint16>(packet.constData() + 4);
+	}
+	QCOMPARE(questionCount, questions.size());
+}
+
+void TestMdnsQueryCoalescer::repeatWithinWindow()
+{
+	const QList<MdnsQueryCoalescer::Question> questions = questionsFor(50);
+	MdnsQueryCoalescer coalescer;
+	const MdnsRecordCache cache;
+	QCOMPARE(coalescer.build(questions, cache, 0).size(), 2);
+	QVERIFY(coalescer.build(questions, cache, MdnsQueryCoalescer::InFlightWindowMs - 1).isEmpty());
+	QCOMPARE(coalescer.build(questions, cache, MdnsQueryCoalescer::InFlightWindowMs).size(), 2);
+}
+
+void TestMdnsQueryCoalescer::scheduledRepeatGoesOut()
+{
+	// The scheduler's first repeat comes a second later, and QTimer may fire it up to 5% early
+	const QList<MdnsQueryCoalescer::Question> questions = questionsFor(1);
+	MdnsQueryCoalescer coalescer;
+	const MdnsRecordCache cache;
+	QCOMPARE(coalescer.build(questions, cache, 0).size(), 1);
+	QCOMPARE(coalescer.build(questions, cache, CastIt::MdnsQueryScheduler::InitialIntervalMs * 95 / 100).size(), 1);
+}
+
+QTEST_APPLESS_MAIN(TestMdnsQueryCoalescer)
+#include "tst_mdns_query_coalescer.moc"
@@ -0,0 +1,212 @@
+// Serves a sparse file past the 4 GiB mark to several keep-alive clients at once, each asking for
+// its own set of byte ranges, and checks every response's status, Content-Range, length and bytes.
+// Patterned blocks sit at offsets that need more than 32 bits, so a truncated offset shows up as
+// the wrong bytes rather than passing on zeros.
+#include "core/media_server.h"
+#include <QEventLoop>
+#include <QFile>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using CastIt::MediaServer;
+
+namespace
+{
+	constexpr qint64 GiB = 1024ll * 1024 * 1024;
+	constexpr qint64 FileSize = 5 * GiB + 12345;
+	constexpr qint64 BlockSize = 64 * 1024;
+	constexpr int Clients = 6;
+
+	// Where patterned data lives; everything else reads back as zeros
+	const qint64 BlockOffsets[] = { 0, 2 * GiB - BlockSize / 2, 4 * GiB - BlockSize / 2, 4 * GiB + 3 * BlockSize,
+		FileSize - BlockSize };
+
+	char patternAt(qint64 offset)
+	{
+		return char((quint64(offset) * 2654435761u) >> 24);
+	}
+
+	QByteArray expectedBytes(qint64 first, qint64 last)
+	{
+		QByteArray bytes(last - first + 1, '\0');
+		for (const qint64 block : BlockOffsets)
+		{
+			const qint64 from = qMax(first, block);
+			const qint64 to = qMin(last, block + BlockSize - 1);
+			for (qint64 offset = from; offset <= to; ++offset)
+				bytes[offset - first] = patternAt(offset);
+		}
+		return bytes;
+	}
+
+	struct Response
+	{
+		QByteArray head;
+		QByteArray body;
+	};
+
+	bool fetch(QTcpSocket& socket, const QByteArray& request, Response& response)
+	{
+		socket.write(request);
+		if (!socket.waitForBytesWritten(10000))
+			return false;
+
+		QByteArray data;
+		qsizetype headEnd = -1;
+		while (headEnd < 0)
+		{
+			if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(10000))
+				return false;
+			data += socket.readAll();
+			headEnd = data.indexOf("\r\n\r\n");
+		}
+		response.head = data.left(headEnd);
+		response.body = data.mid(headEnd + 4);
+
+		qint64 contentLength = 0;
+		for (const QByteArray& line : response.head.split('\n'))
+		{
+			if (line.toLower().startsWith("content-length:"))
+				contentLength = line.mid(15).trimmed().toLongLong();
+		}
+		while (response.body.size() < contentLength)
+		{
+			if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(10000))
+				return false;
+			response.body += socket.read(contentLength - response.body.size());
+		}
+		return response.body.size() == contentLength;
+	}
+
+	QByteArray header(const QByteArray& head, const QByteArray& name)
+	{
+		for (const QByteArray& line : head.split('\n'))
+		{
+			const qsizetype colon = line.indexOf(':');
+			if (colon > 0 && line.left(colon).trimmed().toLower() == name)
+				return line.mid(colon + 1).trimmed();
+		}
+		return QByteArray();
+	}
+}
+
+class TestMediaServerRanges : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void concurrentRanges();
+
+private:
+	QTemporaryDir directory;
+	QByteArray path;
+
+	// Checks one client's ranges on its own connection; returns what went wrong, empty on success
+	QString runClient(int clientIndex, quint16 port) const;
+};
+
+void TestMediaServerRanges::initTestCase()
+{
+	QVERIFY(directory.isValid());
+	QFile file(directory.filePath("sparse.bin"));
+	QVERIFY(file.open(QIODevice::WriteOnly));
+	if (!file.resize(FileSize))
+		QSKIP("No room for a sparse 5 GiB file here");
+	for (const qint64 block : BlockOffsets)
+	{
+		QByteArray data(BlockSize, Qt::Uninitialized);
+		for (qint64 i = 0; i < BlockSize; ++i)
+			data[i] = patternAt(block + i);
+		QVERIFY(file.seek(block));
+		QCOMPARE(file.write(data), BlockSize);
+	}
+	file.close();
+
+	MediaServer* server = MediaServer::instance();
+	server->setPacing(0.0, 0);
+	const QString token = server->publish(file.fileName(), "application/octet-stream");
+	QVERIFY2(!token.isEmpty(), qPrintable(server->errorString()));
+	path = "/media/" + token.toLatin1() + "/sparse.bin";
+}
+
+QString TestMediaServerRanges::runClient(int clientIndex, quint16 port) const
+{
+	QTcpSocket socket;
+	socket.connectToHost(QHostAddress::LocalHost, port);
+	if (!socket.waitForConnected(10000))
+		return "cannot connect";
+
+	// Every client crosses the 4 GiB boundary and reads each block edge, from a different shift
+	const qint64 shift = qint64(clientIndex) * 4099;
+	QList<QPair<qint64, qint64>> ranges;
+	for (const qint64 block : BlockOffsets)
+	{
+		const qint64 first = qBound<qint64>(0, block - 1000 + shift, FileSize - 1);
+		ranges.append({ first, qMin(FileSize - 1, first + BlockSize / 2) });
+	}
+	ranges.append({ 4 * GiB - 100 - shift, 4 * GiB + 100 + shift });
+	ranges.append({ FileSize - 1 - shift, FileSize - 1 }); // Up to the last byte
+
+	for (const auto& [first, last] : ranges)
+	{
+		const QByteArray request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nRange: bytes=" +
+			QByteArray::number(first) + '-' + QByteArray::number(last) + "\r\n\r\n";
+		Response response;
+		if (!fetch(socket, request, response))
+			return QString("bytes %1-%2: no complete response").arg(first).arg(last);
+		if (!response.head.startsWith("HTTP/1.1 206"))
+			return QString("bytes %1-%2: %3").arg(first).arg(last).arg(QString::fromLatin1(response.head.left(response.head.indexOf('\r'))));
+
+		const QByteArray contentRange = "bytes " + QByteArray::number(first) + '-' + QByteArray::number(last) + '/' +
+			QByteArray::number(FileSize);
+		if (header(response.head, "content-range") != contentRange)
+			return QString("bytes %1-%2: Content-Range %3").arg(first).arg(last).arg(QString::fromLatin1(header(response.head, "content-range")));
+		if (response.body != expectedBytes(first, last))
+			return QString("bytes %1-%2: wrong content").arg(first).arg(last);
+	}
+
+	// A suffix range resolves against the full 64-bit size
+	Response response;
+	if (!fetch(socket, "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nRange: bytes=-5000\r\n\r\n", response))
+		return "suffix range: no complete response";
+	if (header(response.head, "content-range") != "bytes " + QByteArray::number(FileSize - 5000) + '-' +
+		QByteArray::number(FileSize - 1) + '/' + QByteArray::number(FileSize))
+		return "suffix range: wrong Content-Range";
+	if (response.body != expectedBytes(FileSize - 5000, FileSize - 1))
+		return "suffix range: wrong content";
+	return QString();
+}
+
+void TestMediaServerRanges::concurrentRanges()
+{
+	// The listener lives on this thread, so clients run on their own while the event loop spins
+	// Every socket wait times out after 10 s, so the clients always finish
+	const quint16 port = MediaServer::instance()->port();
+	std::vector<QString> failures(Clients);
+	std::atomic<int> running = Clients;
+	QEventLoop loop;
+	std::vector<std::thread> clients;
+	for (int i = 0; i < Clients; ++i)
+	{
+		clients.emplace_back([&, i]()
+			{
+				failures[i] = runClient(i, port);
+				if (--running == 0)
+					QMetaObject::invokeMethod(&loop, &QEventLoop::quit, Qt::QueuedConnection);
+			});
+	}
+	loop.exec();
+	for (std::thread& client : clients)
+		client.join();
+
+	for (int i = 0; i < Clients; ++i)
+		QVERIFY2(failures[i].isEmpty(), qPrintable(QString("client %1: %2").arg(i).arg(failures[i])));
+}
+
+QTEST_GUILESS_MAIN(TestMediaServerRanges)
+#include "tst_media_server_ranges.moc"